@@ -0,0 +1,184 @@
+#ifndef FIXED_CLOTH_HH
+#define FIXED_CLOTH_HH
+
+#include "sim.hh"
+#include <stdint.h>
+
+// NOTE: compile time kernels for the cloth sizes we deploy. the structural
+// links come from the grid like the stencil solver, while the top row links
+// and the render index buffer are tables built by the compiler, so every
+// bound in a step is a constant the compiler can unroll by. Cloth uses one
+// when its solver is FIXED and its size matches, see fixed_cloth_update.
+
+static constexpr int GRID_STRIP_BAND = 16;
+
+// NOTE: the grid as one triangle strip walked in bands of GRID_STRIP_BAND
+// columns, so the previous row is still in the post transform cache, with
+// degenerate triangles stitching the rows together. returns the index
+// count and only writes them if out isn't null.
+template <typename T>
+constexpr int grid_strip(int w, int h, T *out)
+{
+    int count = 0;
+    T last = 0;
+    for (int j0 = 0; j0 < w - 1; j0 += GRID_STRIP_BAND)
+    {
+        int j1 = j0 + GRID_STRIP_BAND < w - 1 ? j0 + GRID_STRIP_BAND : w - 1;
+        for (int i = 0; i < h - 1; ++i)
+        {
+            if (count > 0)
+            {
+                if (out != nullptr)
+                {
+                    out[count] = last;
+                    out[count + 1] = T(j0 + i*w);
+                }
+                count += 2;
+            }
+
+            for (int j = j0; j <= j1; ++j)
+            {
+                last = T(j + (i + 1)*w);
+                if (out != nullptr)
+                {
+                    out[count] = T(j + i*w);
+                    out[count + 1] = last;
+                }
+                count += 2;
+            }
+        }
+    }
+    return count;
+}
+
+template <int W, int H>
+struct StripIndices
+{
+    static_assert(W*H <= 0x10000, "fixed grids draw with 16 bit indices");
+    static constexpr int COUNT = grid_strip<uint16_t>(W, H, nullptr);
+    uint16_t data[COUNT];
+
+    constexpr StripIndices() : data()
+    {
+        grid_strip(W, H, data);
+    }
+};
+
+struct RowLink
+{
+    int a, b, span;
+};
+
+// NOTE: same links, in the same order, as the top row constraints Cloth
+// builds, so a fixed kernel steps bit for bit like the stencil solver.
+template <int W>
+struct RowLinks
+{
+    static constexpr int COUNT = W*(W - 1)/2;
+    RowLink data[COUNT];
+
+    constexpr RowLinks() : data()
+    {
+        int k = 0;
+        for (int j = 1; j < W; ++j)
+        {
+            for (int i = j; i < W; ++i)
+            {
+                data[k++] = {i, i - j, j};
+            }
+        }
+    }
+};
+
+template <int W, int H, int Iterations>
+struct FixedCloth
+{
+    static_assert(W >= 2 && H >= 2, "cloth needs at least a 2x2 grid");
+
+    static constexpr int width = W;
+    static constexpr int height = H;
+    static constexpr int iterations = Iterations;
+    static constexpr RowLinks<W> row_links = {};
+    static constexpr StripIndices<W, H> indices = {};
+
+    static bool matches(int w, int h, int n)
+    {
+        return w == W && h == H && n == Iterations;
+    }
+
+    // NOTE: same steps as Cloth::update with the stencil solver
+    static void update(Cloth &cloth, float dt)
+    {
+        Particle *points = cloth.points.data();
+        for (int i = 0; i < W*H; ++i)
+        {
+            points[i].update(dt);
+        }
+
+        for (int k = 0; k < Iterations; ++k)
+        {
+            solve(points, cloth.link_x, cloth.link_y);
+        }
+    }
+
+    static void solve(Particle *points, float link_x, float link_y)
+    {
+        for (int i = 0; i < H; ++i)
+        {
+            Particle *row = &points[i*W];
+            for (int parity = 0; parity < 2; ++parity)
+            {
+                for (int j = parity; j + 1 < W; j += 2)
+                {
+                    project(row[j], row[j + 1], 0, link_x);
+                }
+            }
+
+            if (i + 1 == H) break;
+
+            Particle *next = row + W;
+            for (int j = 0; j < W; ++j)
+            {
+                project(row[j], next[j], 0, link_y);
+            }
+        }
+
+        for (auto &l : row_links.data)
+        {
+            project(points[l.a], points[l.b], 0, link_x*float(l.span));
+        }
+    }
+};
+
+template <int W, int H, int Iterations>
+constexpr RowLinks<W> FixedCloth<W, H, Iterations>::row_links;
+
+template <int W, int H, int Iterations>
+constexpr StripIndices<W, H> FixedCloth<W, H, Iterations>::indices;
+
+// NOTE: the configuration the demo ships with, recreate_cloth's default
+typedef FixedCloth<50, 50, 30> DefaultFixedCloth;
+
+inline bool has_fixed_kernel(int width, int height, int iterations)
+{
+    return DefaultFixedCloth::matches(width, height, iterations);
+}
+
+inline bool has_fixed_kernel(Cloth const &cloth)
+{
+    return has_fixed_kernel(cloth.width, cloth.height, cloth.iterations);
+}
+
+// steps the cloth with its compiled kernel, false if there's none for it
+inline bool fixed_cloth_update(Cloth &cloth, float dt)
+{
+    if (has_fixed_kernel(cloth))
+    {
+        DefaultFixedCloth::update(cloth, dt);
+        return true;
+    }
+
+    return false;
+}
+
+#endif // FIXED_CLOTH_HH
@@ -10,7 +10,14 @@
 #endif
 
 #include "sim.hh"
+#include "fixed_cloth.hh"
 #include <stdlib.h>
+#include <string.h>
+
+#if !defined(EMSCRIPTEN) && !defined(_WIN32)
+#define HAS_SHARED_VIEW
+#include "shared.hh"
+#endif
 
 static int g_width;
 static int g_height;
@@ -73,6 +80,7 @@ struct ClothRender
 {
     Cloth sim;
     GLuint sim_vbo;
+    GLuint sim_uv_vbo;
     GLuint sim_ebo;
     GLuint sim_shader;
     GLuint sim_texture;
@@ -83,26 +91,54 @@ struct ClothRender
     GLint sim_sampler_loc;
     float sim_accumlator = 0;
 
-    struct Vertex
-    {
-        float xy[2];
-        float uv[2];
-    };
+    // NOTE: physics runs at a fixed rate independent of the display, frames
+    // in between are drawn by interpolating from the previous step.
+    float sim_dt = 1/60.0f;
 
-    std::vector<Vertex> vertex_data;
+    // NOTE: only positions change every frame, uvs and indices are
+    // uploaded once per grid size. indices are 16 bit whenever the grid
+    // fits since webgl 1 needs an extension for 32 bit ones.
+    std::vector<Vec2> vertex_data;
+    std::vector<Vec2> uv_data;
     std::vector<uint32_t> index_data;
+    std::vector<uint16_t> short_index_data;
+    GLenum index_type;
+    int index_count = 0;
 
     GLuint point_vbo;
     GLuint point_shader;
-    GLint point_uv_attrib;
     GLint point_pos_attrib;
     GLint point_aspect_loc;
-    std::vector<Vertex> point_vertex_data;
+    GLint point_size_loc;
+    std::vector<Vec2> point_data;
     static constexpr float POINT_RADIUS = 0.025;
     
     Vec2 mouse_delta = {};
     Particle *held_particle = nullptr;
     bool is_setup = false;
+    ClothSolver solver = ClothSolver::RELAX;
+
+    // NOTE: level of detail, the grid resolution is picked from the measured
+    // cost of a step so that physics takes at most LOD_BUDGET of real time.
+    // relaxation needs about resolution^2 sweeps to carry a pull across the
+    // grid, so iterations grow with it, LOD_ITERATIONS at LOD_REFERENCE,
+    // to keep the cloth equally stiff and hanging the same at every level.
+    int sim_resolution = 50;
+    float step_cost = 0; // seconds per unit of work_for(), smoothed
+    float lod_timer = 0;
+    static constexpr float LOD_BUDGET = 0.3;
+    static constexpr float LOD_INTERVAL = 1;
+    static constexpr int LOD_MIN = 10;
+    static constexpr int LOD_MAX = 120;
+    static constexpr int LOD_REFERENCE = 50;
+    static constexpr int LOD_ITERATIONS = 30;
+
+#ifdef HAS_SHARED_VIEW
+    // NOTE: when viewing, states come from a server's shared memory instead
+    // of stepping the solver here, and drags are sent back to it.
+    SharedState *view = nullptr;
+    std::vector<Vec2> view_data;
+#endif
 
     void setup()
     {
@@ -151,23 +187,21 @@ void main()
         constexpr char point_vs[] =
 VS_PREFIX
 R"(
-in vec2 uv;
 in vec2 pos;
-out vec2 tex;
 uniform vec2 aspect;
+uniform float point_size;
 void main()
 {
-    tex = uv;
+    gl_PointSize = point_size;
     gl_Position = vec4(pos/aspect, 0., 1.);
 })";
 
         constexpr char point_fs[] =
 FS_PREFIX
 R"(
-in vec2 tex;
 void main()
 {
-    float d = length(tex - .5) - .5;
+    float d = length(gl_PointCoord - .5) - .5;
     float s = fwidth(d)*.5;
     float c = smoothstep(s, -s, d);
     fragColor = vec4(1, 0, 0, c);
@@ -186,6 +220,7 @@ void main()
 
         glGenBuffers(1, &sim_ebo);
         glGenBuffers(1, &sim_vbo);
+        glGenBuffers(1, &sim_uv_vbo);
 
         constexpr uint8_t image_data[4][4] = {
             {0, 255, 0, 255}, {255, 255, 0, 255},
@@ -194,7 +229,6 @@ void main()
 
         glGenTextures(1, &sim_texture);
         update_texture_data(&image_data[0][0], 2, 2);
-        generate_indices();
 
         sim_uv_attrib = glGetAttribLocation(sim_shader, "uv");
         sim_pos_attrib = glGetAttribLocation(sim_shader, "pos");
@@ -206,13 +240,16 @@ void main()
         GLuint point_vao;
         glGenVertexArrays(1, &point_vao);
         glBindVertexArray(point_vao);
+
+        // NOTE: pinned points are point sprites, sized in the shader
+        glEnable(GL_PROGRAM_POINT_SIZE);
 #endif
 
         glGenBuffers(1, &point_vbo);
 
-        point_uv_attrib = glGetAttribLocation(point_shader, "uv");
         point_pos_attrib = glGetAttribLocation(point_shader, "pos");
         point_aspect_loc = glGetUniformLocation(point_shader, "aspect");
+        point_size_loc = glGetUniformLocation(point_shader, "point_size");
 
         is_setup = true;
     }
@@ -220,10 +257,110 @@ void main()
     void recreate_cloth(int width, int height)
     {
         float aspect = float(height)/float(width);
-        sim = Cloth({-.75f, .75f}, {1.5f, 1.5f*aspect}, 50, 50);
+        int w = sim_resolution;
+        int h = sim_resolution;
+
+#ifdef HAS_SHARED_VIEW
+        if (view != nullptr)
+        {
+            w = view->header->width;
+            h = view->header->height;
+        }
+#endif
+
+        sim = Cloth({-.75f, .75f}, {1.5f, 1.5f*aspect}, w, h, solver);
+        sim.iterations = iterations_for(sim_resolution);
+        held_particle = nullptr;
+        generate_indices();
         generate_vertices();
     }
 
+    void resize_cloth(int resolution)
+    {
+        sim_resolution = resolution;
+        Cloth next({-.75f, .75f}, sim.size, 
+                   resolution, resolution, solver);
+        next.iterations = iterations_for(resolution);
+        next.resample(sim);
+
+        // keep dragging whichever pinned point is now under the mouse
+        if (held_particle != nullptr)
+        {
+            Vec2 held = held_particle->pos;
+            held_particle = nullptr;
+            for (auto &p : next.points)
+            {
+                if (p.fixed && (held_particle == nullptr || 
+                    p.pos.dist(held) < held_particle->pos.dist(held)))
+                {
+                    held_particle = &p;
+                }
+            }
+        }
+
+        sim = std::move(next);
+        generate_indices();
+        generate_vertices();
+    }
+
+    // NOTE: switches solver in place, keeping the cloth where it is
+    void set_solver(ClothSolver next)
+    {
+#ifdef HAS_SHARED_VIEW
+        if (view != nullptr) return;
+#endif
+
+        solver = next;
+        step_cost = 0;
+
+        // the fixed kernel only exists for the reference size
+        static_assert(DefaultFixedCloth::width == LOD_REFERENCE &&
+                      DefaultFixedCloth::height == LOD_REFERENCE &&
+                      DefaultFixedCloth::iterations == LOD_ITERATIONS,
+                      "the shipped fixed kernel is the reference lod");
+        resize_cloth(solver == ClothSolver::FIXED ? 
+                     LOD_REFERENCE : sim_resolution);
+    }
+
+    static int iterations_for(int resolution)
+    {
+        float scale = float(resolution)/LOD_REFERENCE;
+        int iterations = (int)roundf(LOD_ITERATIONS*scale*scale);
+        return iterations > 1 ? iterations : 1;
+    }
+
+    // relative cost of a step. implicit steps don't sweep, their cholesky
+    // over a nested dissection order grows as particles^1.5 (measured
+    // 0.18, 2.4 and 41 ms per step at 20, 50 and 120 squared).
+    float work_for(int resolution) const
+    {
+        float particles = float(resolution)*resolution;
+        if (solver == ClothSolver::IMPLICIT) 
+        {
+            return particles*sqrtf(particles);
+        }
+        return particles*iterations_for(resolution);
+    }
+
+    void update_lod()
+    {
+        if (step_cost <= 0) return;
+        if (solver == ClothSolver::FIXED) return;
+
+        int resolution = LOD_MAX;
+        while (resolution > LOD_MIN && 
+               work_for(resolution)*step_cost > LOD_BUDGET*sim_dt)
+        {
+            --resolution;
+        }
+
+        // NOTE: only switch on a big enough change to avoid flip-flopping
+        if (abs(resolution - sim_resolution) > sim_resolution/5)
+        {
+            resize_cloth(resolution);
+        }
+    }
+
     void update_texture_data(uint8_t const *data, 
                              int width, int height)
     {
@@ -239,63 +376,126 @@ void main()
         recreate_cloth(width, height);
     }
 
+    // NOTE: see grid_strip, fixed kernels come with their strip built by
+    // the compiler so only other sizes generate theirs here.
     void generate_indices()
     {
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sim_ebo);
-        index_data.resize(6*(sim.width - 1)*(sim.height - 1));
-        for (int i = 0; i < sim.height - 1; ++i)
+        if (sim.solver == ClothSolver::FIXED && has_fixed_kernel(sim))
         {
-            for (int j = 0; j < sim.width - 1; ++j)
+            auto const &indices = DefaultFixedCloth::indices;
+            index_type = GL_UNSIGNED_SHORT;
+            index_count = indices.COUNT;
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, 
+                         sizeof indices.data,
+                         indices.data,
+                         GL_STATIC_DRAW);
+        }
+        else
+        {
+            int w = sim.width;
+            int h = sim.height;
+            index_data.resize(grid_strip<uint32_t>(w, h, nullptr));
+            grid_strip(w, h, index_data.data());
+            index_count = index_data.size();
+
+            if (w*h <= 0x10000)
             {
-                int vertex = (j + i*(sim.width));
-                int index = 6*(j + i*(sim.width - 1));
-                
-                // lower left triangle
-                index_data[index + 0] = vertex;
-                index_data[index + 1] = vertex + sim.width;
-                index_data[index + 2] = vertex + sim.width + 1;
-                
-                // upper right triangle
-                index_data[index + 3] = vertex;
-                index_data[index + 4] = vertex + 1;
-                index_data[index + 5] = vertex + sim.width + 1;      
+                index_type = GL_UNSIGNED_SHORT;
+                short_index_data.assign(index_data.begin(), 
+                                        index_data.end());
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, 
+                             short_index_data.size()*
+                             sizeof short_index_data[0],
+                             short_index_data.data(),
+                             GL_STATIC_DRAW);
+            }
+            else
+            {
+                index_type = GL_UNSIGNED_INT;
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, 
+                             index_data.size()*
+                             sizeof index_data[0],
+                             index_data.data(),
+                             GL_STATIC_DRAW);
             }
         }
 
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, 
-                     index_data.size()*
-                     sizeof index_data[0],
-                     index_data.data(),
-                     GL_DYNAMIC_DRAW);
-    }
-
-    void generate_vertices()
-    {
-        glBindBuffer(GL_ARRAY_BUFFER, sim_vbo);
-        vertex_data.resize(sim.width*sim.height);
+        uv_data.resize(sim.width*sim.height);
         for (int i = 0; i < sim.height; ++i)
         {
             for (int j = 0; j < sim.width; ++j)
             {
-                int index = j + i*sim.width;
-                vertex_data[index] = {
-                    {sim.points[index].pos.x, sim.points[index].pos.y},
-                    {j/float(sim.width - 1), i/float(sim.height - 1)},
+                uv_data[j + i*sim.width] = {
+                    j/float(sim.width - 1), i/float(sim.height - 1),
                 };
             }
         }
 
+        glBindBuffer(GL_ARRAY_BUFFER, sim_uv_vbo);
+        glBufferData(GL_ARRAY_BUFFER, 
+                     uv_data.size() * 
+                     sizeof uv_data[0],
+                     uv_data.data(), 
+                     GL_STATIC_DRAW);
+    }
+
+    void set_physics_rate(int hz)
+    {
+        sim_dt = 1/float(hz);
+        sim_accumlator = fminf(sim_accumlator, sim_dt);
+    }
+
+    // NOTE: old_pos always holds the previous step's state, so the render
+    // lags one step behind and blends towards the latest one.
+    void generate_vertices()
+    {
+        float alpha = fminf(sim_accumlator/sim_dt, 1);
+
+        glBindBuffer(GL_ARRAY_BUFFER, sim_vbo);
+        vertex_data.resize(sim.points.size());
+        point_data.clear();
+        for (size_t i = 0; i < sim.points.size(); ++i)
+        {
+            Particle &p = sim.points[i];
+            vertex_data[i] = p.old_pos + (p.pos - p.old_pos)*alpha;
+
+            // pinned points are drawn where the cloth's corners are drawn
+            if (p.fixed) point_data.push_back(vertex_data[i]);
+        }
+
         glBufferData(GL_ARRAY_BUFFER, 
                      vertex_data.size() * 
                      sizeof vertex_data[0],
                      vertex_data.data(), 
                      GL_DYNAMIC_DRAW);                
+
+        glBindBuffer(GL_ARRAY_BUFFER, point_vbo);
+        glBufferData(GL_ARRAY_BUFFER, 
+                     point_data.size() * 
+                     sizeof point_data[0],
+                     point_data.data(), 
+                     GL_DYNAMIC_DRAW);
     }
 
-    void update_points()
+    void drag(Vec2 target)
     {
-        point_vertex_data.clear();
+#ifdef HAS_SHARED_VIEW
+        if (view != nullptr)
+        {
+            int index = held_particle - sim.points.data();
+            view->send({CommandType::MOVE, index, target.x, target.y});
+            return;
+        }
+#endif
+
+        held_particle->pos += (target - held_particle->pos)*0.25f;
+    }
 
+    // NOTE: picks against the positions drawn last frame, the sprites
+    // themselves are uploaded with the cloth in generate_vertices.
+    void update_points()
+    {
         float min_dist = -1;
         Particle *nearest = nullptr;
 
@@ -303,26 +503,13 @@ void main()
         Uint32 button = SDL_GetMouseState(&x, &y);
 
         Vec2 mouse = screen_to_point(Vec2{(float)x, (float)y});    
-        for (auto &p : sim.points)
+        bool drawn = vertex_data.size() == sim.points.size();
+        for (size_t i = 0; i < sim.points.size(); ++i)
         {
+            Particle &p = sim.points[i];
             if (!p.fixed) continue;
 
-            // add a quad to draw this point
-            Vec2 q = p.pos;
-            float size = POINT_RADIUS;
-            point_vertex_data.insert(point_vertex_data.end(),
-                                     {
-                                        // upper right
-                                        {{q.x - size, q.y + size}, {0, 1}},
-                                        {{q.x + size, q.y + size}, {1, 1}},
-                                        {{q.x + size, q.y - size}, {1, 0}},
-                                        
-                                        // lower left
-                                        {{q.x - size, q.y + size}, {0, 1}},
-                                        {{q.x - size, q.y - size}, {0, 0}},
-                                        {{q.x + size, q.y - size}, {1, 0}},
-                                     });
-
+            Vec2 q = drawn ? vertex_data[i] : p.pos;
             float d = q.dist(mouse);
             if (d < POINT_RADIUS && 
                 (min_dist < 0 || d < min_dist))
@@ -342,34 +529,78 @@ void main()
 
             if (held_particle != nullptr) 
             {
-                held_particle->pos += 
-                    (mouse + mouse_delta - 
-                     held_particle->pos)*0.25f;
+                drag(mouse + mouse_delta);
             }
         }
         else
         {
+#ifdef HAS_SHARED_VIEW
+            if (view != nullptr && held_particle != nullptr)
+            {
+                view->send({CommandType::RELEASE, -1, 0, 0});
+            }
+#endif
             held_particle = nullptr;
         }
+    }
 
-        glBindBuffer(GL_ARRAY_BUFFER, point_vbo);
-        glBufferData(GL_ARRAY_BUFFER, 
-                     point_vertex_data.size() * 
-                     sizeof point_vertex_data[0],
-                     point_vertex_data.data(), 
-                     GL_DYNAMIC_DRAW);
+#ifdef HAS_SHARED_VIEW
+    void update_view()
+    {
+        update_points();
+
+        uint64_t step;
+        view_data.resize(sim.points.size());
+        if (view->read_latest(view_data.data(), &step))
+        {
+            for (size_t i = 0; i < sim.points.size(); ++i)
+            {
+                sim.points[i].pos = view_data[i];
+                sim.points[i].old_pos = view_data[i];
+            }
+        }
+
+        generate_vertices();
     }
+#endif
 
     void update(float dt)
     {
+#ifdef HAS_SHARED_VIEW
+        if (view != nullptr)
+        {
+            update_view();
+            return;
+        }
+#endif
+
         update_points();
 
-        constexpr float min_dt = 1/60.0f;
+        int steps = 0;
+        Uint64 start = SDL_GetPerformanceCounter();
         sim_accumlator += fminf(dt, 0.25f);
-        while (sim_accumlator >= min_dt)
+        while (sim_accumlator >= sim_dt)
         {
-            sim.update(min_dt);
-            sim_accumlator -= min_dt;
+            sim.update(sim_dt);
+            sim_accumlator -= sim_dt;
+            ++steps;
+        }
+
+        if (steps > 0)
+        {
+            double elapsed = 
+                double(SDL_GetPerformanceCounter() - start)/
+                double(SDL_GetPerformanceFrequency());
+            float cost = float(elapsed/steps/work_for(sim_resolution));
+            step_cost = step_cost > 0 ? 
+                step_cost + (cost - step_cost)*0.1f : cost;
+        }
+
+        lod_timer += dt;
+        if (lod_timer >= LOD_INTERVAL)
+        {
+            lod_timer = 0;
+            update_lod();
         }
 
         generate_vertices();
@@ -381,40 +612,33 @@ void main()
         glUseProgram(point_shader);
 
         glBindBuffer(GL_ARRAY_BUFFER, point_vbo);
-        glEnableVertexAttribArray(point_uv_attrib);
         glEnableVertexAttribArray(point_pos_attrib);
-        
-        glVertexAttribPointer(point_uv_attrib, 2, GL_FLOAT, 
-                              GL_FALSE, sizeof(Vertex), 
-                              (void *)(offsetof(Vertex, uv)));
-        
         glVertexAttribPointer(point_pos_attrib, 2, GL_FLOAT, 
-                              GL_FALSE, sizeof(Vertex), 
-                              (void *)(offsetof(Vertex, xy)));
+                              GL_FALSE, sizeof(Vec2), nullptr);
 
+        // diameter in pixels, clip space spans 2 units over the height
+        glUniform1f(point_size_loc, POINT_RADIUS*g_height/g_aspect.y);
         glUniform2f(point_aspect_loc, g_aspect.x, g_aspect.y);
-        glDrawArrays(GL_TRIANGLES, 0, point_vertex_data.size());
+        glDrawArrays(GL_POINTS, 0, point_data.size());
 
         glUseProgram(sim_shader);
 
-        glBindBuffer(GL_ARRAY_BUFFER, sim_vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, sim_uv_vbo);
         glEnableVertexAttribArray(sim_uv_attrib);
-        glEnableVertexAttribArray(sim_pos_attrib);
-        
         glVertexAttribPointer(sim_uv_attrib, 2, GL_FLOAT, 
-                              GL_FALSE, sizeof(Vertex), 
-                              (void *)(offsetof(Vertex, uv)));
-        
+                              GL_FALSE, sizeof(Vec2), nullptr);
+
+        glBindBuffer(GL_ARRAY_BUFFER, sim_vbo);
+        glEnableVertexAttribArray(sim_pos_attrib);
         glVertexAttribPointer(sim_pos_attrib, 2, GL_FLOAT, 
-                              GL_FALSE, sizeof(Vertex), 
-                              (void *)(offsetof(Vertex, xy)));
+                              GL_FALSE, sizeof(Vec2), nullptr);
 
         glUniform2f(sim_aspect_loc, g_aspect.x, g_aspect.y);
         
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sim_ebo);
-        glDrawElements(GL_TRIANGLES, 
-                       index_data.size(),
-                       GL_UNSIGNED_INT, 
+        glDrawElements(GL_TRIANGLE_STRIP, 
+                       index_count,
+                       index_type, 
                        nullptr);
     }
 };
@@ -442,6 +666,26 @@ struct LoopData
             {
                 exit(0);
             }
+
+            // 1 to 4 pick the relax, stencil, implicit and fixed solvers
+            if (e.type == SDL_KEYDOWN)
+            {
+                switch (e.key.keysym.sym)
+                {
+                case SDLK_1: 
+                    simulation.set_solver(ClothSolver::RELAX); 
+                    break;
+                case SDLK_2: 
+                    simulation.set_solver(ClothSolver::STENCIL); 
+                    break;
+                case SDLK_3: 
+                    simulation.set_solver(ClothSolver::IMPLICIT); 
+                    break;
+                case SDLK_4: 
+                    simulation.set_solver(ClothSolver::FIXED); 
+                    break;
+                }
+            }
         }
 
         int w, h;
@@ -490,12 +734,67 @@ extern "C" void update_cloth_sim(int w, int h)
     if (!loop_data.simulation.is_setup) return;
     loop_data.simulation.recreate_cloth(w, h);
 }
+
+EMSCRIPTEN_KEEPALIVE
+extern "C" void set_physics_rate(int hz)
+{
+    if (hz <= 0) return;
+    loop_data.simulation.set_physics_rate(hz);
+}
+
+EMSCRIPTEN_KEEPALIVE
+extern "C" void set_cloth_solver(int solver)
+{
+    if (!loop_data.simulation.is_setup) return;
+    if (solver < 0 || solver > (int)ClothSolver::FIXED) return;
+    loop_data.simulation.set_solver((ClothSolver)solver);
+}
 #endif
 
 int main(int argc, char *argv[])
 {
-    (void)argc;
-    (void)argv;
+    // prog [--hz rate] [--view name], --hz sets the physics rate and
+    // --view watches a running server instead of simulating.
+#ifdef HAS_SHARED_VIEW
+    static SharedState view;
+#endif
+    for (int i = 1; i < argc; i += 2)
+    {
+        if (i + 1 == argc)
+        {
+            printf("missing value for %s\n", argv[i]);
+            return -1;
+        }
+
+        if (strcmp(argv[i], "--hz") == 0)
+        {
+            int hz = atoi(argv[i + 1]);
+            if (hz <= 0)
+            {
+                printf("bad physics rate %s\n", argv[i + 1]);
+                return -1;
+            }
+
+            loop_data.simulation.set_physics_rate(hz);
+        }
+#ifdef HAS_SHARED_VIEW
+        else if (strcmp(argv[i], "--view") == 0)
+        {
+            if (!view.attach(argv[i + 1]))
+            {
+                printf("can't attach to %s\n", argv[i + 1]);
+                return -1;
+            }
+
+            loop_data.simulation.view = &view;
+        }
+#endif
+        else
+        {
+            printf("unknown argument %s\n", argv[i]);
+            return -1;
+        }
+    }
 
     if (SDL_Init(SDL_INIT_VIDEO) < 0)
     {
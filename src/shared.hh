@@ -0,0 +1,285 @@
+#ifndef SHARED_HH
+#define SHARED_HH
+
+// NOTE: lets one headless server step the simulation and publish every
+// finished state into shared memory for any number of local viewers. the
+// segment holds a ring of frames, each guarded by a seqlock, so readers
+// never block the writer and just retry if a frame changed under them.
+// viewers send interaction back over a unix datagram socket.
+//
+// posix only, the windows and wasm builds don't include this.
+
+#include "vec.hh"
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static constexpr uint32_t SHARED_MAGIC = 0x636c6f74; // "clot"
+static constexpr uint32_t SHARED_VERSION = 1;
+static constexpr int SHARED_SLOTS = 4;
+
+struct SharedHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t width, height;
+    std::atomic<uint64_t> latest; // number of frames published
+};
+
+struct SharedFrameHeader
+{
+    std::atomic<uint64_t> seq; // odd while being written
+    uint64_t step;
+    float dt;
+};
+
+// NOTE: a frame is its header followed by width*height positions
+inline size_t shared_frame_size(int width, int height)
+{
+    return sizeof(SharedFrameHeader) + sizeof(Vec2)*width*height;
+}
+
+inline size_t shared_size(int width, int height)
+{
+    return sizeof(SharedHeader) + 
+           SHARED_SLOTS*shared_frame_size(width, height);
+}
+
+enum class CommandType : uint32_t
+{
+    MOVE,    // pull particle index towards (x, y)
+    RELEASE, // stop pulling
+};
+
+struct Command
+{
+    CommandType type;
+    int32_t index;
+    float x, y;
+};
+
+// NOTE: size is that of sockaddr_un::sun_path, false if either name
+// doesn't fit or the name isn't a single path component.
+inline bool shared_names(char const *name, char *shm, char *sock, size_t size)
+{
+    if (name[0] == '\0' || strchr(name, '/') != nullptr) return false;
+
+    int shm_length = snprintf(shm, size, "/%s", name);
+    int sock_length = snprintf(sock, size, "/tmp/%s.sock", name);
+    return shm_length >= 0 && (size_t)shm_length < size &&
+           sock_length >= 0 && (size_t)sock_length < size;
+}
+
+// NOTE: a datagram connect only succeeds while something is bound to the
+// path, a socket file left behind by a server that died is refused.
+inline bool shared_socket_stale(sockaddr_un const &address)
+{
+    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd < 0) return false;
+
+    bool stale = connect(fd, (sockaddr const *)&address, 
+                         sizeof address) != 0 && errno == ECONNREFUSED;
+    close(fd);
+    return stale;
+}
+
+struct SharedState
+{
+    SharedHeader *header = nullptr;
+    size_t size = 0;
+    int socket_fd = -1;
+    sockaddr_un address = {};
+
+    SharedFrameHeader *frame(uint64_t n) const
+    {
+        size_t slot = n % SHARED_SLOTS;
+        char *base = (char *)(header + 1);
+        return (SharedFrameHeader *)(
+            base + slot*shared_frame_size(header->width, header->height));
+    }
+
+    Vec2 *frame_data(SharedFrameHeader const *f) const
+    {
+        return (Vec2 *)(f + 1);
+    }
+
+    // server side, binds the command socket and creates the segment. the
+    // bound socket doubles as the lock on the name, so a second server
+    // fails instead of taking over a live one's segment.
+    bool create(char const *name, int width, int height)
+    {
+        char shm[sizeof address.sun_path], sock[sizeof address.sun_path];
+        if (!shared_names(name, shm, sock, sizeof shm))
+        {
+            fprintf(stderr, "bad shared state name %s\n", name);
+            return false;
+        }
+
+        socket_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+        if (socket_fd < 0) return false;
+        fcntl(socket_fd, F_SETFL, O_NONBLOCK);
+
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, sock, strlen(sock) + 1);
+        if (bind(socket_fd, (sockaddr *)&address, sizeof address) != 0)
+        {
+            // only clean up after a server that's gone
+            if (errno != EADDRINUSE || !shared_socket_stale(address))
+            {
+                fprintf(stderr, "%s is already being served\n", name);
+                close(socket_fd);
+                socket_fd = -1;
+                return false;
+            }
+
+            unlink(sock);
+            shm_unlink(shm);
+            if (bind(socket_fd, (sockaddr *)&address, sizeof address) != 0)
+            {
+                close(socket_fd);
+                socket_fd = -1;
+                return false;
+            }
+        }
+
+        int fd = shm_open(shm, O_CREAT | O_EXCL | O_RDWR, 0644);
+        size = shared_size(width, height);
+        if (fd >= 0 && ftruncate(fd, size) != 0)
+        {
+            close(fd);
+            shm_unlink(shm);
+            fd = -1;
+        }
+
+        void *data = fd < 0 ? MAP_FAILED : 
+            mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (fd >= 0) close(fd);
+        if (data == MAP_FAILED)
+        {
+            if (fd >= 0) shm_unlink(shm);
+            close(socket_fd);
+            unlink(sock);
+            socket_fd = -1;
+            return false;
+        }
+
+        memset(data, 0, size);
+        header = (SharedHeader *)data;
+        header->width = width;
+        header->height = height;
+        header->version = SHARED_VERSION;
+        header->latest.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = SHARED_MAGIC;
+        return true;
+    }
+
+    // viewer side, maps the segment read only
+    bool attach(char const *name)
+    {
+        char shm[sizeof address.sun_path], sock[sizeof address.sun_path];
+        if (!shared_names(name, shm, sock, sizeof shm)) return false;
+
+        int fd = shm_open(shm, O_RDONLY, 0);
+        if (fd < 0) return false;
+
+        SharedHeader probe;
+        if (read(fd, &probe, sizeof probe) != sizeof probe ||
+            probe.magic != SHARED_MAGIC ||
+            probe.version != SHARED_VERSION)
+        {
+            close(fd);
+            return false;
+        }
+
+        size = shared_size(probe.width, probe.height);
+        void *data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) return false;
+        header = (SharedHeader *)data;
+
+        socket_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+        if (socket_fd < 0) return false;
+        fcntl(socket_fd, F_SETFL, O_NONBLOCK);
+
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, sock, strlen(sock) + 1);
+        return true;
+    }
+
+    void destroy(char const *name)
+    {
+        char shm[sizeof address.sun_path], sock[sizeof address.sun_path];
+        if (!shared_names(name, shm, sock, sizeof shm)) return;
+
+        if (header != nullptr) munmap(header, size);
+        if (socket_fd >= 0) close(socket_fd);
+        shm_unlink(shm);
+        unlink(sock);
+        header = nullptr;
+        socket_fd = -1;
+    }
+
+    void publish(Vec2 const *positions, uint64_t step, float dt)
+    {
+        uint64_t n = header->latest.load(std::memory_order_relaxed);
+        SharedFrameHeader *f = frame(n);
+
+        f->seq.store(2*n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        f->step = step;
+        f->dt = dt;
+        memcpy(frame_data(f), positions, 
+               sizeof(Vec2)*header->width*header->height);
+
+        f->seq.store(2*n + 2, std::memory_order_release);
+        header->latest.store(n + 1, std::memory_order_release);
+    }
+
+    // NOTE: copies the newest consistent frame, returns false if nothing
+    // has been published yet. with SHARED_SLOTS frames in the ring the
+    // writer has to lap a reader several times before it has to retry.
+    bool read_latest(Vec2 *positions, uint64_t *step) const
+    {
+        for (;;)
+        {
+            uint64_t n = header->latest.load(std::memory_order_acquire);
+            if (n == 0) return false;
+
+            SharedFrameHeader const *f = frame(n - 1);
+            uint64_t before = f->seq.load(std::memory_order_acquire);
+            if (before != 2*n) continue;
+
+            *step = f->step;
+            memcpy(positions, frame_data(f),
+                   sizeof(Vec2)*header->width*header->height);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (f->seq.load(std::memory_order_relaxed) == before)
+            {
+                return true;
+            }
+        }
+    }
+
+    void send(Command const &c) const
+    {
+        sendto(socket_fd, &c, sizeof c, 0,
+               (sockaddr const *)&address, sizeof address);
+    }
+
+    bool receive(Command *c) const
+    {
+        return recv(socket_fd, c, sizeof *c, 0) == sizeof *c;
+    }
+};
+
+#endif // SHARED_HH
@@ -1,5 +1,9 @@
 #include "sim.hh"
+#include "fixed_cloth.hh"
 #include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
 
 void Particle::update(float dt)
 {
@@ -13,11 +17,14 @@ void Particle::update(float dt)
     old_pos = copy;
 }
 
-Rope::Rope(Vec2 start, Vec2 end, int count) :
-    points(count + 2)
+Rope::Rope(Vec2 start, Vec2 end, int count, 
+           RopeSolver s, int newton_iterations) :
+    points(count + 2),
+    solver(s),
+    newton_iterations(newton_iterations),
+    link_length(end.dist(start)/(count + 1))
 {
     Vec2 step = (end - start)/float(count + 1);
-    float line_width = end.dist(start)/(count + 1);
     for (int i = 0; i < count + 2; ++i)
     {
         points[i] = {
@@ -31,6 +38,20 @@ Rope::Rope(Vec2 start, Vec2 end, int count) :
         start = start + step;
     }
 
+    points[0].fixed = true;
+
+    if (solver == RopeSolver::DIRECT)
+    {
+        links.resize(count + 1);
+        lengths.resize(count + 1);
+        tension.assign(count + 1, 0);
+        targets.resize(count + 2);
+        pivots.resize(count + 2);
+        couplings.resize(count + 2);
+        rhs.resize(3*(count + 2));
+        return;
+    }
+
     for (int j = 1; j <= 10; ++j)
     {
         for (int i = j; i < count + 2; ++i)
@@ -38,12 +59,244 @@ Rope::Rope(Vec2 start, Vec2 end, int count) :
             constraints.push_back({
                 &points[i], 
                 &points[i - j], 
-                0, line_width*j
+                0, link_length*j
             });
         }
     }
+}
 
-    points[0].fixed = true;
+static RopeBlock inverse(RopeBlock const &b)
+{
+    auto &m = b.m;
+    RopeBlock r;
+    r.m[0][0] = m[1][1]*m[2][2] - m[1][2]*m[2][1];
+    r.m[0][1] = m[0][2]*m[2][1] - m[0][1]*m[2][2];
+    r.m[0][2] = m[0][1]*m[1][2] - m[0][2]*m[1][1];
+    r.m[1][0] = m[1][2]*m[2][0] - m[1][0]*m[2][2];
+    r.m[1][1] = m[0][0]*m[2][2] - m[0][2]*m[2][0];
+    r.m[1][2] = m[0][2]*m[1][0] - m[0][0]*m[1][2];
+    r.m[2][0] = m[1][0]*m[2][1] - m[1][1]*m[2][0];
+    r.m[2][1] = m[0][1]*m[2][0] - m[0][0]*m[2][1];
+    r.m[2][2] = m[0][0]*m[1][1] - m[0][1]*m[1][0];
+
+    double det = m[0][0]*r.m[0][0] + m[0][1]*r.m[1][0] + m[0][2]*r.m[2][0];
+    for (auto &row : r.m)
+    {
+        for (auto &v : row) v /= det;
+    }
+    return r;
+}
+
+// NOTE: a^T*b, the blocks below the diagonal are the transposed couplings
+static RopeBlock transpose_multiply(RopeBlock const &a, RopeBlock const &b)
+{
+    RopeBlock r;
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+        {
+            r.m[i][j] = a.m[0][i]*b.m[0][j] + a.m[1][i]*b.m[1][j] + 
+                        a.m[2][i]*b.m[2][j];
+        }
+    }
+    return r;
+}
+
+static void multiply(RopeBlock const &a, double const *v, double *out)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        out[i] = a.m[i][0]*v[0] + a.m[i][1]*v[1] + a.m[i][2]*v[2];
+    }
+}
+
+// NOTE: link tension only resists the link turning when it pulls, (I -
+// u*u^T)*tension/length. compression is left out so the blocks stay
+// positive definite.
+static void add_bending(double (&m)[3][3], Vec2 u, double t, float len,
+                        double sign)
+{
+    double k = sign*fmax(0.0, t)/len;
+    m[0][0] += k*(1 - u.x*u.x);
+    m[0][1] -= k*u.x*u.y;
+    m[1][0] -= k*u.x*u.y;
+    m[1][1] += k*(1 - u.y*u.y);
+}
+
+// NOTE: projects the predicted positions onto the closest chain (weighted
+// by mass) where every link is link_length, by newton on the lagrangian
+//
+//   M*(x - predicted) + J^T*tension = 0,  |x[i+1] - x[i]| = link_length
+//
+// block i holds particle i's position and the tension of link i - 1, every
+// link only couples neighbouring blocks so the system is block tridiagonal
+// and a block thomas sweep solves it in linear time. leaving out the tension
+// term of the hessian (plain gauss newton) makes long chains crawl towards
+// the solution a link per iteration once particles move further than a
+// link per step, with it newton takes a handful of iterations.
+void Rope::solve_direct()
+{
+    constexpr float tolerance = 1e-3f;
+    int n = (int)links.size();
+
+    for (int i = 0; i <= n; ++i)
+    {
+        targets[i] = points[i].pos;
+    }
+
+    // NOTE: one more error check than updates, so a last update that
+    // converges isn't thrown away by the fallback below.
+    for (int k = 0; k <= newton_iterations; ++k)
+    {
+        float max_error = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            Vec2 d = points[i + 1].pos - points[i].pos;
+            lengths[i] = d.length();
+            links[i] = lengths[i] > 0 ? d/lengths[i] : Vec2{0, 0};
+            max_error = fmaxf(max_error, fabsf(lengths[i] - link_length));
+        }
+
+        if (max_error <= tolerance*link_length)
+        {
+            return;
+        }
+
+        if (k == newton_iterations)
+        {
+            break;
+        }
+
+        for (int i = 0; i <= n; ++i)
+        {
+            Particle &p = points[i];
+            RopeBlock &d = pivots[i];
+            RopeBlock &c = couplings[i];
+            d = {};
+            c = {};
+
+            double *r = &rhs[3*i];
+            r[0] = p.mass*(targets[i].x - p.pos.x);
+            r[1] = p.mass*(targets[i].y - p.pos.y);
+            r[2] = i > 0 ? link_length - lengths[i - 1] : 0;
+
+            // fixed particles keep their row trivial so they don't move
+            if (p.fixed)
+            {
+                d.m[0][0] = 1;
+                d.m[1][1] = 1;
+                r[0] = 0;
+                r[1] = 0;
+            }
+            else
+            {
+                d.m[0][0] = p.mass;
+                d.m[1][1] = p.mass;
+                if (i > 0)
+                {
+                    Vec2 u = links[i - 1];
+                    add_bending(d.m, u, tension[i - 1], lengths[i - 1], 1);
+                    d.m[0][2] = d.m[2][0] = u.x;
+                    d.m[1][2] = d.m[2][1] = u.y;
+                }
+
+                if (i < n)
+                {
+                    Vec2 u = links[i];
+                    add_bending(d.m, u, tension[i], lengths[i], 1);
+                    c.m[0][2] = -u.x;
+                    c.m[1][2] = -u.y;
+                    if (!points[i + 1].fixed)
+                    {
+                        add_bending(c.m, u, tension[i], lengths[i], -1);
+                    }
+                }
+            }
+
+            // no link before the first particle, or one between two fixed
+            // particles that can't be corrected.
+            if (i == 0 || (p.fixed && points[i - 1].fixed))
+            {
+                d.m[2][2] = 1;
+                r[2] = 0;
+            }
+        }
+
+        // forward elimination, pivots end up holding the inverses
+        pivots[0] = inverse(pivots[0]);
+        for (int i = 1; i <= n; ++i)
+        {
+            RopeBlock l = transpose_multiply(couplings[i - 1], pivots[i - 1]);
+            RopeBlock &d = pivots[i];
+            double *r = &rhs[3*i];
+            for (int a = 0; a < 3; ++a)
+            {
+                for (int b = 0; b < 3; ++b)
+                {
+                    for (int j = 0; j < 3; ++j)
+                    {
+                        d.m[a][b] -= l.m[a][j]*couplings[i - 1].m[j][b];
+                    }
+                }
+                r[a] -= l.m[a][0]*rhs[3*i - 3] + l.m[a][1]*rhs[3*i - 2] + 
+                        l.m[a][2]*rhs[3*i - 1];
+            }
+            d = inverse(d);
+        }
+
+        // back substitution, the solution overwrites rhs
+        double solution[3];
+        multiply(pivots[n], &rhs[3*n], solution);
+        memcpy(&rhs[3*n], solution, sizeof solution);
+        for (int i = n - 1; i >= 0; --i)
+        {
+            double next[3];
+            multiply(couplings[i], &rhs[3*i + 3], next);
+            for (int a = 0; a < 3; ++a) next[a] = rhs[3*i + a] - next[a];
+            multiply(pivots[i], next, &rhs[3*i]);
+        }
+
+        bool finite = true;
+        for (int i = 0; i <= n; ++i)
+        {
+            double const *x = &rhs[3*i];
+            finite = finite && std::isfinite(x[0] + x[1] + x[2]);
+        }
+
+        // singular system (a chain pinned at both ends and pulled tight),
+        // leave it to relaxation.
+        if (!finite)
+        {
+            break;
+        }
+
+        for (int i = 0; i <= n; ++i)
+        {
+            double const *x = &rhs[3*i];
+            points[i].pos += Vec2{float(x[0]), float(x[1])};
+            if (i > 0) tension[i - 1] = x[2];
+        }
+    }
+
+    // didn't converge, finish off with relaxation along the chain which
+    // can stretch but won't blow up.
+    for (auto &t : tension)
+    {
+        t = 0;
+    }
+
+    for (int j = 0; j < iterations; ++j)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            project(points[i], points[i + 1], link_length, link_length);
+        }
+
+        for (int i = n - 1; i >= 0; --i)
+        {
+            project(points[i], points[i + 1], link_length, link_length);
+        }
+    }
 }
 
 void Rope::update(float dt)
@@ -53,7 +306,13 @@ void Rope::update(float dt)
         p.update(dt);
     }
 
-    for (int j = 0; j < 30; ++j)
+    if (solver == RopeSolver::DIRECT)
+    {
+        solve_direct();
+        return;
+    }
+
+    for (int j = 0; j < iterations; ++j)
     {
         for (auto &c : constraints)
         {
@@ -69,17 +328,73 @@ Cloth &Cloth::operator=(Cloth &&o)
     height = o.height;
     points = std::move(o.points);
     constraints = std::move(o.constraints);
+    solver = o.solver;
+    iterations = o.iterations;
+    stiffness = o.stiffness;
+    damping = o.damping;
+    newton_iterations = o.newton_iterations;
+    tolerance = o.tolerance;
+    link_x = o.link_x;
+    link_y = o.link_y;
+    implicit = std::move(o.implicit);
     return *this;
 }
 
-Cloth::Cloth(Vec2 start, Vec2 s, int w, int h) :
+// NOTE: nested dissection of rows [r0, r1) and columns [c0, c1) of the
+// grid. both halves go before the line splitting them, so eliminating one
+// half never fills in the other and the factor stays sparse.
+static void dissect(int width, int r0, int r1, int c0, int c1,
+                    std::vector<int> &order)
+{
+    int rows = r1 - r0;
+    int cols = c1 - c0;
+    if (rows <= 0 || cols <= 0) return;
+
+    if (rows*cols <= 16)
+    {
+        for (int i = r0; i < r1; ++i)
+        {
+            for (int j = c0; j < c1; ++j)
+            {
+                order.push_back(j + i*width);
+            }
+        }
+        return;
+    }
+
+    if (cols >= rows)
+    {
+        int mid = c0 + cols/2;
+        dissect(width, r0, r1, c0, mid, order);
+        dissect(width, r0, r1, mid + 1, c1, order);
+        for (int i = r0; i < r1; ++i)
+        {
+            order.push_back(mid + i*width);
+        }
+    }
+    else
+    {
+        int mid = r0 + rows/2;
+        dissect(width, r0, mid, c0, c1, order);
+        dissect(width, mid + 1, r1, c0, c1, order);
+        for (int j = c0; j < c1; ++j)
+        {
+            order.push_back(j + mid*width);
+        }
+    }
+}
+
+Cloth::Cloth(Vec2 start, Vec2 s, int w, int h, ClothSolver cs) :
     points(w * h),
     width(w),
     height(h),
-    size(s)
+    size(s),
+    solver(cs)
 {
     Vec2 col = {(size/float(width - 1)).x, 0};
     Vec2 row = {0, (size/float(height - 1)).y};
+    link_x = col.x;
+    link_y = row.y;
 
     for (int i = 0; i < height; ++i)
     {
@@ -91,7 +406,12 @@ Cloth::Cloth(Vec2 start, Vec2 s, int w, int h) :
         }
     }
 
-    for (int i = 0; i < height; ++i)
+    // NOTE: implicit structural springs are two sided, a spring that only
+    // pulls leaves newton chasing links in and out of slack. the stencil
+    // solver derives these from the grid instead. the top row's skip links
+    // stay one sided for every solver, they only stop it stretching.
+    bool two_sided = solver == ClothSolver::IMPLICIT;
+    for (int i = 0; i < height && !grid_links(); ++i)
     {
         for (int j = 0; j < width; ++j)
         {
@@ -100,7 +420,7 @@ Cloth::Cloth(Vec2 start, Vec2 s, int w, int h) :
                 constraints.push_back({
                     &points[j + i*width], 
                     &points[j + 1 + i*width],
-                    0, col.x,
+                    two_sided ? col.x : 0, col.x,
                 });       
             }
 
@@ -109,7 +429,7 @@ Cloth::Cloth(Vec2 start, Vec2 s, int w, int h) :
                 constraints.push_back({
                     &points[j + i*width], 
                     &points[j + (i + 1)*width],
-                    0, row.y,
+                    two_sided ? row.y : 0, row.y,
                 });       
             }
         }
@@ -134,61 +454,647 @@ Cloth::Cloth(Vec2 start, Vec2 s, int w, int h) :
     
     points[0].fixed = true;
     points[width - 1].fixed = true;
+
+    if (solver == ClothSolver::IMPLICIT)
+    {
+        // the top row is linked all the way across so it goes last
+        std::vector<int> order;
+        dissect(width, 1, height, 0, width, order);
+        for (int j = 0; j < width; ++j)
+        {
+            order.push_back(j);
+        }
+        implicit.setup(points, constraints, order);
+    }
 }
 
 void Cloth::update(float dt)
+{
+    if (solver == ClothSolver::IMPLICIT)
+    {
+        update_implicit(dt);
+        return;
+    }
+
+    // sizes without a compiled kernel step like the stencil solver
+    if (solver == ClothSolver::FIXED && fixed_cloth_update(*this, dt))
+    {
+        return;
+    }
+
+    integrate(dt);
+    for (int j = 0; j < iterations; ++j)
+    {
+        relax();
+    }
+}
+
+void Cloth::integrate(float dt)
 {
     for (auto &p : points)
     {
         p.update(dt);
     }
+}
 
-    for (int j = 0; j < 30; ++j)
+// NOTE: a single relaxation sweep over every link
+void Cloth::relax()
+{
+    if (grid_links())
     {
-        for (auto &c : constraints)
+        solve_stencil();
+    }
+
+    for (auto &c : constraints)
+    {
+        c.apply();
+    }
+}
+
+int Cloth::link_count() const
+{
+    int links = constraints.size();
+    if (grid_links())
+    {
+        links += (width - 1)*height + width*(height - 1);
+    }
+    return links;
+}
+
+// NOTE: structural links are implied by the grid, every particle links to
+// its right and down neighbour. rows go top to bottom like the relax
+// order, so the pull of the pinned top row reaches the hem in one sweep.
+// each row's horizontal links are swept in two parities, so no two links
+// in the same inner loop share a particle, then its links down.
+void Cloth::solve_stencil()
+{
+    for (int i = 0; i < height; ++i)
+    {
+        Particle *row = &points[i*width];
+        for (int parity = 0; parity < 2; ++parity)
         {
-            c.apply();
+            for (int j = parity; j + 1 < width; j += 2)
+            {
+                project(row[j], row[j + 1], 0, link_x);
+            }
+        }
+
+        if (i + 1 == height) break;
+
+        Particle *next = row + width;
+        for (int j = 0; j < width; ++j)
+        {
+            project(row[j], next[j], 0, link_y);
+        }
+    }
+}
+
+// NOTE: bilinearly samples positions (and old positions, so velocity
+// carries over) from another cloth covering the same grid, used to switch
+// resolution without the cloth visibly snapping back to its rest shape.
+void Cloth::resample(Cloth const &from)
+{
+    auto sample = [&](int i, int j, Vec2 Particle::*field) {
+        float v = i*float(from.height - 1)/float(height - 1);
+        float u = j*float(from.width - 1)/float(width - 1);
+        int i0 = std::min(int(v), from.height - 2);
+        int j0 = std::min(int(u), from.width - 2);
+        float fv = v - i0;
+        float fu = u - j0;
+
+        Particle const *row0 = &from.points[i0*from.width];
+        Particle const *row1 = row0 + from.width;
+        Vec2 top = row0[j0].*field*(1 - fu) + row0[j0 + 1].*field*fu;
+        Vec2 bottom = row1[j0].*field*(1 - fu) + row1[j0 + 1].*field*fu;
+        return top*(1 - fv) + bottom*fv;
+    };
+
+    for (int i = 0; i < height; ++i)
+    {
+        for (int j = 0; j < width; ++j)
+        {
+            Particle &p = points[j + i*width];
+            p.pos = sample(i, j, &Particle::pos);
+            p.old_pos = p.fixed ? p.pos : sample(i, j, &Particle::old_pos);
         }
     }
 }
 
 void Constraint::apply()
-{                              
-    float dist = a->pos.dist(b->pos);
-    
-    float error = 0;
-    if (dist < min_dist)
-    { 
-        error = dist - min_dist;
+{
+    project(*a, *b, min_dist, max_dist);
+}
+
+void ImplicitSystem::setup(std::vector<Particle> const &points,
+                           std::vector<Constraint> const &constraints,
+                           std::vector<int> const &order)
+{
+    int n = points.size();
+    Particle const *base = points.data();
+
+    std::vector<std::vector<int>> neighbours(n);
+    for (int i = 0; i < n; ++i)
+    {
+        neighbours[i].push_back(i);
     }
-    else if (dist > max_dist) 
+
+    for (auto &c : constraints)
     {
-        error = dist - max_dist;
+        int a = c.a - base;
+        int b = c.b - base;
+        neighbours[a].push_back(b);
+        neighbours[b].push_back(a);
     }
 
-    // NOTE: both weights should sum to 1 or 0(both are fixed).
-    float mass = a->mass + b->mass;
+    row_start.resize(n + 1);
+    diag.resize(n);
+    cols.clear();
+    for (int i = 0; i < n; ++i)
+    {
+        auto &row = neighbours[i];
+        std::sort(row.begin(), row.end());
+        row.erase(std::unique(row.begin(), row.end()), row.end());
 
-    float a_weight = 1 - a->mass/mass;
-    float b_weight = 1 - b->mass/mass;
+        row_start[i] = cols.size();
+        for (int j : row)
+        {
+            if (j == i) diag[i] = cols.size();
+            cols.push_back(j);
+        }
+    }
+    row_start[n] = cols.size();
 
-    if (a->fixed && b->fixed)
+    auto find_slot = [&](int row, int col) {
+        auto first = cols.begin() + row_start[row];
+        auto last = cols.begin() + row_start[row + 1];
+        return int(std::lower_bound(first, last, col) - cols.begin());
+    };
+
+    slots.resize(4*constraints.size());
+    for (size_t k = 0; k < constraints.size(); ++k)
     {
-        a_weight = 0;
-        b_weight = 0;
+        int a = constraints[k].a - base;
+        int b = constraints[k].b - base;
+        slots[4*k + 0] = diag[a];
+        slots[4*k + 1] = diag[b];
+        slots[4*k + 2] = find_slot(a, b);
+        slots[4*k + 3] = find_slot(b, a);
     }
-    else if (a->fixed)
+
+    blocks.resize(cols.size());
+
+    // unknown 2*k + axis is the axis of the k-th particle in order
+    int m = 2*n;
+    std::vector<int> position(n);
+    unknowns.resize(m);
+    for (int k = 0; k < n; ++k)
     {
-        a_weight = 0;
-        b_weight = 1;
-    } 
-    else if (b->fixed)
+        position[order[k]] = k;
+        unknowns[2*k + 0] = 2*order[k] + 0;
+        unknowns[2*k + 1] = 2*order[k] + 1;
+    }
+
+    // the matrix is symmetric so column k's upper triangle is the part of
+    // its particle's block row that comes no later in the order.
+    upper_start.resize(m + 1);
+    upper_rows.clear();
+    upper_source.clear();
+    for (int k = 0; k < m; ++k)
     {
-        b_weight = 0;
-        a_weight = 1;
+        upper_start[k] = upper_rows.size();
+        int particle = unknowns[k]/2;
+        int axis = unknowns[k]%2;
+        for (int s = row_start[particle]; s < row_start[particle + 1]; ++s)
+        {
+            for (int other = 0; other < 2; ++other)
+            {
+                int row = 2*position[cols[s]] + other;
+                if (row > k) continue;
+                upper_rows.push_back(row);
+                upper_source.push_back(4*s + 2*axis + other);
+            }
+        }
+    }
+    upper_start[m] = upper_rows.size();
+
+    // elimination tree, with path compression through ancestor
+    parent.assign(m, -1);
+    std::vector<int> ancestor(m, -1);
+    for (int k = 0; k < m; ++k)
+    {
+        for (int p = upper_start[k]; p < upper_start[k + 1]; ++p)
+        {
+            int i = upper_rows[p];
+            while (i != -1 && i < k)
+            {
+                int next = ancestor[i];
+                ancestor[i] = k;
+                if (next == -1) parent[i] = k;
+                i = next;
+            }
+        }
+    }
+
+    // every row's pattern adds one entry to each column it reaches
+    pattern.resize(m);
+    stack.resize(m);
+    marks.assign(m, -1);
+    cursor.resize(m);
+    std::vector<int> counts(m, 1);
+    for (int k = 0; k < m; ++k)
+    {
+        for (int t = row_pattern(k); t < m; ++t)
+        {
+            ++counts[pattern[t]];
+        }
+    }
+
+    factor_start.resize(m + 1);
+    factor_start[0] = 0;
+    for (int k = 0; k < m; ++k)
+    {
+        factor_start[k + 1] = factor_start[k] + counts[k];
+    }
+
+    factor_rows.resize(factor_start[m]);
+    factor.resize(factor_start[m]);
+    work.assign(m, 0);
+
+    start.resize(n);
+    predicted.resize(n);
+    before.resize(n);
+    rhs.resize(n);
+    dx.resize(n);
+}
+
+// NOTE: the columns row k of the factor has entries in, found by walking
+// the elimination tree up from every entry of the matrix's column k. the
+// pattern ends up in pattern[top, m) in topological order.
+int ImplicitSystem::row_pattern(int k)
+{
+    int m = unknowns.size();
+    int top = m;
+    marks[k] = k;
+    for (int p = upper_start[k]; p < upper_start[k + 1]; ++p)
+    {
+        int length = 0;
+        for (int i = upper_rows[p]; marks[i] != k; i = parent[i])
+        {
+            stack[length++] = i;
+            marks[i] = k;
+        }
+
+        while (length > 0)
+        {
+            pattern[--top] = stack[--length];
+        }
+    }
+    return top;
+}
+
+static float block_entry(Mat2 const &b, int entry)
+{
+    switch (entry)
+    {
+        case 0: return b.xx;
+        case 1: return b.xy;
+        case 2: return b.yx;
+        default: return b.yy;
+    }
+}
+
+// NOTE: up looking cholesky, row k of the factor is a sparse triangular
+// solve against the rows above it. returns false if the matrix turned out
+// not to be positive definite.
+bool ImplicitSystem::factorize()
+{
+    int m = unknowns.size();
+    std::vector<int> &next = cursor;
+    for (int k = 0; k < m; ++k)
+    {
+        next[k] = factor_start[k];
+        marks[k] = -1;
+    }
+
+    for (int k = 0; k < m; ++k)
+    {
+        int top = row_pattern(k);
+
+        for (int p = upper_start[k]; p < upper_start[k + 1]; ++p)
+        {
+            int source = upper_source[p];
+            work[upper_rows[p]] = block_entry(blocks[source/4], source%4);
+        }
+
+        double d = work[k];
+        work[k] = 0;
+        for (int t = top; t < m; ++t)
+        {
+            int i = pattern[t];
+            double lki = work[i]/factor[factor_start[i]];
+            work[i] = 0;
+            for (int p = factor_start[i] + 1; p < next[i]; ++p)
+            {
+                work[factor_rows[p]] -= factor[p]*lki;
+            }
+
+            d -= lki*lki;
+            int p = next[i]++;
+            factor_rows[p] = k;
+            factor[p] = lki;
+        }
+
+        if (d <= 0)
+        {
+            return false;
+        }
+
+        int p = next[k]++;
+        factor_rows[p] = k;
+        factor[p] = sqrt(d);
+    }
+
+    return true;
+}
+
+// NOTE: dx = A^-1 rhs with the factor from factorize
+void ImplicitSystem::solve()
+{
+    int m = unknowns.size();
+    for (int k = 0; k < m; ++k)
+    {
+        Vec2 v = rhs[unknowns[k]/2];
+        work[k] = unknowns[k]%2 == 0 ? v.x : v.y;
+    }
+
+    for (int k = 0; k < m; ++k)
+    {
+        work[k] /= factor[factor_start[k]];
+        for (int p = factor_start[k] + 1; p < factor_start[k + 1]; ++p)
+        {
+            work[factor_rows[p]] -= factor[p]*work[k];
+        }
+    }
+
+    for (int k = m - 1; k >= 0; --k)
+    {
+        for (int p = factor_start[k] + 1; p < factor_start[k + 1]; ++p)
+        {
+            work[k] -= factor[p]*work[factor_rows[p]];
+        }
+        work[k] /= factor[factor_start[k]];
+    }
+
+    for (int k = 0; k < m; ++k)
+    {
+        Vec2 &v = dx[unknowns[k]/2];
+        if (unknowns[k]%2 == 0) v.x = work[k];
+        else v.y = work[k];
+        work[k] = 0;
+    }
+}
+
+// NOTE: how far a link is outside [min_dist, max_dist], and the end it's
+// pulled towards. two sided links (min_dist == max_dist) stay engaged at zero
+// stretch too, so the hessian doesn't flicker as they cross their rest.
+static bool violation(Constraint const &c, double len, 
+                      float *rest, double *stretch)
+{
+    *rest = len > c.max_dist ? c.max_dist : c.min_dist;
+    *stretch = 0;
+    if (len > c.max_dist || len < c.min_dist)
+    {
+        *stretch = len - *rest;
+    }
+
+    return *stretch != 0 || c.min_dist == c.max_dist;
+}
+
+// NOTE: implicit euler is the minimum of
+//
+//   1/2 |x - predicted|^2_M + h^2 E_springs(x) + h D(x)
+//
+// over the end of step positions x, where predicted is where the particles
+// would coast to without the springs. springs only pull once a pair leaves
+// [min_dist, max_dist]; the cloth's own links are two sided.
+// damping acts along the links engaged at the start of the step.
+// everything is scaled by h^2 so the hessian is M + h*C + h^2*K.
+double Cloth::implicit_energy(float dt) const
+{
+    auto &sys = implicit;
+    Particle const *base = points.data();
+
+    // NOTE: differences are taken in doubles, close to the minimum the
+    // energy changes less than float rounding of the terms would.
+    auto sub = [](Vec2 a, Vec2 b, double *x, double *y) {
+        *x = double(a.x) - b.x;
+        *y = double(a.y) - b.y;
+    };
+
+    double energy = 0;
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+        Particle const &pt = points[i];
+        if (pt.fixed) continue;
+
+        double x, y;
+        sub(pt.pos, sys.predicted[i], &x, &y);
+        energy += 0.5*pt.mass*(x*x + y*y);
+    }
+
+    for (auto &c : constraints)
+    {
+        int a = c.a - base;
+        int b = c.b - base;
+
+        double x, y, x0, y0;
+        sub(c.a->pos, c.b->pos, &x, &y);
+        sub(sys.start[a], sys.start[b], &x0, &y0);
+
+        float rest;
+        double stretch;
+        if (violation(c, sqrt(x*x + y*y), &rest, &stretch) && rest > 0)
+        {
+            energy += 0.5*dt*dt*(stiffness/rest)*stretch*stretch;
+        }
+
+        double len0 = sqrt(x0*x0 + y0*y0);
+        if (violation(c, len0, &rest, &stretch) && len0 > 0)
+        {
+            double s = ((x - x0)*x0 + (y - y0)*y0)/len0;
+            energy += 0.5*dt*damping*s*s;
+        }
+    }
+
+    return energy;
+}
+
+// NOTE: newton on implicit_energy, starting from where the particles would
+// coast to. each step is halved until the energy goes down, which keeps it
+// stable at any timestep even when springs snap taut part way through.
+// refactoring dominates the cost, so the factor is kept across iterations
+// and steps (a chord step, still a descent direction since it's positive
+// definite) and only redone once it stops at least halving the step.
+void Cloth::update_implicit(float dt)
+{
+    int n = points.size();
+    auto &sys = implicit;
+    Particle *base = points.data();
+    float step_tolerance = tolerance*fminf(link_x, link_y);
+
+    for (int i = 0; i < n; ++i)
+    {
+        Particle &pt = points[i];
+        sys.start[i] = pt.pos;
+        if (pt.fixed)
+        {
+            sys.predicted[i] = pt.pos;
+            continue;
+        }
+
+        sys.predicted[i] = 2*pt.pos - pt.old_pos + dt*dt*pt.acc;
+        pt.pos = 2*pt.pos - pt.old_pos;
+    }
+
+    bool refactor = !sys.factored || dt != sys.factored_dt;
+    float last_step = INFINITY;
+    for (int k = 0; k < newton_iterations; ++k)
+    {
+        if (refactor)
+        {
+            for (auto &b : sys.blocks)
+            {
+                b = {0, 0, 0, 0};
+            }
+
+            for (int i = 0; i < n; ++i)
+            {
+                sys.blocks[sys.diag[i]] = Mat2::identity()*points[i].mass;
+            }
+        }
+
+        for (int i = 0; i < n; ++i)
+        {
+            Particle &pt = points[i];
+            sys.rhs[i] = pt.fixed ? 
+                Vec2{0, 0} : (sys.predicted[i] - pt.pos)*pt.mass;
+        }
+
+        for (size_t c = 0; c < constraints.size(); ++c)
+        {
+            Constraint &con = constraints[c];
+            int a = con.a - base;
+            int b = con.b - base;
+            Vec2 x = con.a->pos - con.b->pos;
+            Vec2 x0 = sys.start[a] - sys.start[b];
+            float len = x.length();
+            float len0 = x0.length();
+
+            Vec2 force = {0, 0};
+            Mat2 j = {0, 0, 0, 0};
+
+            float rest;
+            double stretch;
+            if (violation(con, len, &rest, &stretch) && rest > 0 && len > 0)
+            {
+                // stiffness is per unit strain, so long links aren't stiffer
+                float ks = dt*dt*stiffness/rest;
+                Vec2 dir = x/len;
+                Mat2 nn = Mat2::outer(dir, dir);
+                force -= dir*(ks*stretch);
+                j += (nn + (Mat2::identity() - nn)*fmaxf(0, 1 - rest/len))*ks;
+            }
+
+            if (violation(con, len0, &rest, &stretch) && len0 > 0)
+            {
+                Vec2 dir = x0/len0;
+                force -= dir*(dt*damping*(x - x0).dot(dir));
+                j += Mat2::outer(dir, dir)*(dt*damping);
+            }
+
+            if (!con.a->fixed) sys.rhs[a] += force;
+            if (!con.b->fixed) sys.rhs[b] -= force;
+            if (!refactor) continue;
+
+            if (!con.a->fixed)
+            {
+                sys.blocks[sys.slots[4*c + 0]] += j;
+            }
+
+            if (!con.b->fixed)
+            {
+                sys.blocks[sys.slots[4*c + 1]] += j;
+            }
+
+            if (!con.a->fixed && !con.b->fixed)
+            {
+                sys.blocks[sys.slots[4*c + 2]] -= j;
+                sys.blocks[sys.slots[4*c + 3]] -= j;
+            }
+        }
+
+        if (refactor)
+        {
+            // can't fail with the clamped hessian short of nans, keep the
+            // positions as they are rather than step along garbage.
+            sys.factored = sys.factorize();
+            sys.factored_dt = dt;
+            if (!sys.factored) break;
+        }
+        sys.solve();
+
+        double energy = implicit_energy(dt);
+        float largest = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            sys.before[i] = points[i].pos;
+            largest = fmaxf(largest, sys.dx[i].length());
+        }
+
+        float scale = 1;
+        for (;;)
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                points[i].pos = sys.before[i] + sys.dx[i]*scale;
+            }
+
+            if (implicit_energy(dt) <= energy) break;
+
+            scale *= 0.5f;
+            if (largest*scale < step_tolerance)
+            {
+                for (int i = 0; i < n; ++i)
+                {
+                    points[i].pos = sys.before[i];
+                }
+                break;
+            }
+        }
+
+        float step = largest*scale;
+        if (step < step_tolerance && !refactor)
+        {
+            // a stale factor that can't make progress, retry with a fresh one
+            if (scale < 1)
+            {
+                refactor = true;
+                continue;
+            }
+            break;
+        }
+
+        if (step < step_tolerance)
+        {
+            break;
+        }
+
+        refactor = scale < 1 || step > 0.5f*last_step;
+        last_step = step;
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+        points[i].old_pos = sys.start[i];
     }
-    
-    Vec2 delta = (a->pos - b->pos).normalize()*error;
-    a->pos -= delta*a_weight;
-    b->pos += delta*b_weight;
 }
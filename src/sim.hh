@@ -15,6 +15,48 @@ struct Particle
     void update(float dt);
 };
 
+inline void project(Particle &a, Particle &b, 
+                    float min_dist, float max_dist)
+{
+    float dist = a.pos.dist(b.pos);
+    
+    float error = 0;
+    if (dist < min_dist)
+    { 
+        error = dist - min_dist;
+    }
+    else if (dist > max_dist) 
+    {
+        error = dist - max_dist;
+    }
+
+    // NOTE: both weights should sum to 1 or 0(both are fixed).
+    float mass = a.mass + b.mass;
+
+    float a_weight = 1 - a.mass/mass;
+    float b_weight = 1 - b.mass/mass;
+
+    if (a.fixed && b.fixed)
+    {
+        a_weight = 0;
+        b_weight = 0;
+    }
+    else if (a.fixed)
+    {
+        a_weight = 0;
+        b_weight = 1;
+    } 
+    else if (b.fixed)
+    {
+        b_weight = 0;
+        a_weight = 1;
+    }
+    
+    Vec2 delta = (a.pos - b.pos).normalize()*error;
+    a.pos -= delta*a_weight;
+    b.pos += delta*b_weight;
+}
+
 struct Constraint
 {
     Particle *a, *b;
@@ -23,14 +65,95 @@ struct Constraint
     void apply();
 };
 
+enum class RopeSolver
+{
+    RELAX,  // iterative relaxation over skip constraints
+    DIRECT, // tridiagonal solve of the linearized chain
+};
+
+// NOTE: one 3x3 block of the direct rope solver's system, per particle its
+// position and the tension of the link before it. doubles since the system
+// of a long chain is badly conditioned.
+struct RopeBlock
+{
+    double m[3][3];
+};
+
 struct Rope
 {
     std::vector<Particle> points;
     std::vector<Constraint> constraints;
+    RopeSolver solver;
+    int iterations = 30;
+
+    // NOTE: upper bound, the direct solver stops early once every link is
+    // within tolerance of link_length.
+    int newton_iterations;
+    float link_length;
+
+    // NOTE: scratch space for the direct solver, kept around so that
+    // stepping doesn't allocate. tension carries over to warm start the
+    // next step.
+    std::vector<Vec2> links, targets;
+    std::vector<float> lengths;
+    std::vector<double> tension;
+    std::vector<RopeBlock> pivots, couplings;
+    std::vector<double> rhs;
     
-    Rope(Vec2 start, Vec2 end, int count);
+    Rope(Vec2 start, Vec2 end, int count, 
+         RopeSolver solver = RopeSolver::RELAX,
+         int newton_iterations = 32);
 
     void update(float dt);
+    void solve_direct();
+};
+
+enum class ClothSolver
+{
+    RELAX,    // iterative constraint relaxation
+    STENCIL,  // relaxation with structural links implied by the grid
+    IMPLICIT, // implicit euler over two sided constraint springs
+    FIXED,    // stencil with a compile time kernel, see fixed_cloth.hh
+};
+
+// NOTE: block sparse (2x2 per particle pair) system for implicit euler,
+// solved by sparse cholesky. the sparsity pattern only depends on the
+// constraints, so the elimination order, the pattern of the factor and
+// where every constraint scatters into are worked out once up front and
+// each newton iteration only refills and refactors the values.
+struct ImplicitSystem
+{
+    // blocks by particle, what the springs scatter into
+    std::vector<int> row_start;
+    std::vector<int> cols;
+    std::vector<int> diag;
+    std::vector<int> slots; // aa, bb, ab, ba for each constraint
+    std::vector<Mat2> blocks;
+
+    // scalar unknowns (two per particle) in elimination order, the upper
+    // triangle by column with the block entry each value comes from, the
+    // elimination tree and the factor by column.
+    std::vector<int> unknowns;
+    std::vector<int> upper_start, upper_rows, upper_source;
+    std::vector<int> parent;
+    std::vector<int> factor_start, factor_rows;
+    std::vector<double> factor;
+    bool factored = false;
+    float factored_dt = 0;
+
+    std::vector<int> pattern, stack, marks, cursor;
+    std::vector<double> work;
+
+    std::vector<Vec2> start, predicted, before;
+    std::vector<Vec2> rhs, dx;
+
+    void setup(std::vector<Particle> const &points,
+               std::vector<Constraint> const &constraints,
+               std::vector<int> const &order);
+
+    int row_pattern(int k);
+    bool factorize();
+    void solve();
 };
 
 struct Cloth
@@ -39,12 +162,35 @@ struct Cloth
     std::vector<Constraint> constraints;
     int width, height;
     Vec2 size;
+    float link_x, link_y;
+
+    ClothSolver solver = ClothSolver::RELAX;
+    int iterations = 30;
+    float stiffness = 1000000; // per unit strain
+    float damping = 5;
+    int newton_iterations = 8;
+    float tolerance = 1e-3f; // of a link length
+    ImplicitSystem implicit;
 
     Cloth() = default;
-    Cloth(Vec2 start, Vec2 size, int w, int hs);
+    Cloth(Vec2 start, Vec2 size, int w, int hs,
+          ClothSolver solver = ClothSolver::RELAX);
     Cloth &operator=(Cloth &&o);
 
     void update(float dt);
+    void integrate(float dt);
+    void relax();
+    int link_count() const;
+    void update_implicit(float dt);
+    double implicit_energy(float dt) const;
+    void solve_stencil();
+    void resample(Cloth const &from);
+
+    // structural links come from the grid rather than constraints
+    bool grid_links() const
+    {
+        return solver == ClothSolver::STENCIL || solver == ClothSolver::FIXED;
+    }
 };
 
 #endif // SIM_HH
@@ -64,6 +64,11 @@ struct Vec2
         return sqrtf(x*x + y*y);
     }
 
+    float dot(Vec2 o) const
+    {
+        return x*o.x + y*o.y;
+    }
+
     float dist(Vec2 o) const
     {
         return (*this - o).length();
@@ -82,4 +87,67 @@ struct Vec2
     }
 };
 
+struct Mat2
+{
+    float xx, xy;
+    float yx, yy;
+
+    static Mat2 identity()
+    {
+        return {1, 0, 0, 1};
+    }
+
+    static Mat2 outer(Vec2 a, Vec2 b)
+    {
+        return {a.x*b.x, a.x*b.y, a.y*b.x, a.y*b.y};
+    }
+
+    inline friend Mat2 operator+(Mat2 a, Mat2 b)
+    {
+        return {a.xx + b.xx, a.xy + b.xy, a.yx + b.yx, a.yy + b.yy};
+    }
+
+    inline friend Mat2 operator-(Mat2 a, Mat2 b)
+    {
+        return {a.xx - b.xx, a.xy - b.xy, a.yx - b.yx, a.yy - b.yy};
+    }
+
+    inline friend Mat2 operator*(Mat2 a, float b)
+    {
+        return {a.xx*b, a.xy*b, a.yx*b, a.yy*b};
+    }
+
+    inline friend Mat2 operator*(float a, Mat2 b)
+    {
+        return b*a;
+    }
+
+    inline friend Vec2 operator*(Mat2 a, Vec2 b)
+    {
+        return {a.xx*b.x + a.xy*b.y, a.yx*b.x + a.yy*b.y};
+    }
+
+    Mat2 &operator +=(Mat2 b)
+    {
+        *this = *this + b;
+        return *this;
+    }
+
+    Mat2 &operator -=(Mat2 b)
+    {
+        *this = *this - b;
+        return *this;
+    }
+
+    float determinant() const
+    {
+        return xx*yy - xy*yx;
+    }
+
+    Mat2 inverse() const
+    {
+        return Mat2{yy, -xy, -yx, xx}*(1/determinant());
+    }
+};
+
 #endif // VEC_HH
@@ -0,0 +1,60 @@
+#ifndef ARGS_HH
+#define ARGS_HH
+
+// NOTE: argument helpers shared by the command line tools
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// cloth links span size/(grid - 1), ropes just need a particle
+static constexpr int MIN_CLOTH_GRID = 2;
+static constexpr int MIN_ROPE_GRID = 1;
+
+// splits a comma separated list in place, uses strtok so it can't be
+// nested inside another strtok walk.
+inline std::vector<char *> split_list(char *list)
+{
+    std::vector<char *> out;
+    for (char *s = strtok(list, ","); s != nullptr; s = strtok(nullptr, ","))
+    {
+        out.push_back(s);
+    }
+    return out;
+}
+
+// parses a whole number of at least lowest, complaining about key if not
+inline bool parse_int(char const *key, char const *text, int lowest, int *out)
+{
+    char *end;
+    long value = strtol(text, &end, 10);
+    if (end == text || *end != '\0')
+    {
+        fprintf(stderr, "%s must be a whole number, got %s\n", key, text);
+        return false;
+    }
+
+    if (value < lowest || value > 0x7fffffff)
+    {
+        fprintf(stderr, "%s must be at least %d, got %s\n", key, lowest, text);
+        return false;
+    }
+
+    *out = (int)value;
+    return true;
+}
+
+inline bool check_grid(char const *kind, int grid)
+{
+    int smallest = strcmp(kind, "rope") == 0 ? MIN_ROPE_GRID : MIN_CLOTH_GRID;
+    if (grid < smallest)
+    {
+        fprintf(stderr, "%s grid must be at least %d, got %d\n", 
+                kind, smallest, grid);
+        return false;
+    }
+    return true;
+}
+
+#endif // ARGS_HH
@@ -0,0 +1,314 @@
+// Hardware counter profile of the cloth solver.
+//
+// usage: profile [key=v1,v2,...]...
+//
+//   grid     cloth width and height, defaults to 20,50,100
+//   solver   relax, stencil, defaults to both
+//   steps    profiled steps per configuration, defaults to 300
+//   warmup   steps run before profiling, defaults to 60
+//
+// integration and every relaxation sweep are bracketed with a group of
+// perf_event_open counters (cycles, instructions, cache misses, branch
+// misses) and one CSV line per phase is printed. misses and bytes are per
+// particle for the integrate phase and per link for the sweep phase, bytes
+// being cache misses times the line size. counters the kernel won't give
+// us (not linux, no permission, no pmu in a vm) are left empty and only
+// wall clock time is reported.
+
+#include "sim.hh"
+#include "args.hh"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static constexpr int CACHE_LINE = 64;
+
+enum Counter
+{
+    CYCLES,
+    INSTRUCTIONS,
+    CACHE_MISSES,
+    BRANCH_MISSES,
+    COUNTER_COUNT,
+};
+
+// NOTE: the counters are one perf group so they're scheduled onto the pmu
+// together and cover exactly the same instructions. if the kernel has to
+// multiplex them with other events, the totals are scaled up by how long
+// the group was enabled over how long it actually counted.
+struct Counters
+{
+    int fds[COUNTER_COUNT] = {-1, -1, -1, -1};
+    int slots[COUNTER_COUNT] = {-1, -1, -1, -1}; // position in a group read
+    int leader = -1;
+    int members = 0;
+    double totals[COUNTER_COUNT] = {};
+    bool counted = false; // the group got onto the pmu at least once
+    double seconds = 0;
+    std::chrono::steady_clock::time_point started;
+
+    bool open()
+    {
+#ifdef __linux__
+        constexpr uint64_t configs[COUNTER_COUNT] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES,
+        };
+
+        for (int i = 0; i < COUNTER_COUNT; ++i)
+        {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof attr;
+            attr.config = configs[i];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP |
+                               PERF_FORMAT_TOTAL_TIME_ENABLED |
+                               PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            // the first counter that opens leads, the group starts disabled
+            attr.disabled = leader < 0;
+            fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+            if (fds[i] < 0) continue;
+
+            if (leader < 0) leader = fds[i];
+            slots[i] = members++;
+        }
+        return leader >= 0;
+#else
+        return false;
+#endif
+    }
+
+    void close_all()
+    {
+#ifdef __linux__
+        for (int fd : fds)
+        {
+            if (fd >= 0) close(fd);
+        }
+#endif
+    }
+
+    bool has(Counter c) const
+    {
+        return fds[c] >= 0 && counted;
+    }
+
+    void reset()
+    {
+        memset(totals, 0, sizeof totals);
+        counted = false;
+        seconds = 0;
+    }
+
+    // NOTE: the clock is read after enabling and before disabling, so the
+    // wall time doesn't include the ioctls.
+    void start()
+    {
+#ifdef __linux__
+        if (leader >= 0)
+        {
+            ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+#endif
+        started = std::chrono::steady_clock::now();
+    }
+
+    void stop()
+    {
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - started;
+        seconds += elapsed.count();
+
+#ifdef __linux__
+        if (leader < 0) return;
+        ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+        // nr, time enabled, time running, then a value per member
+        uint64_t data[3 + COUNTER_COUNT];
+        ssize_t expected = (3 + members)*sizeof data[0];
+        if (read(leader, data, sizeof data) != expected) return;
+
+        uint64_t enabled = data[1];
+        uint64_t running = data[2];
+        if (running == 0) return;
+
+        counted = true;
+        double scale = double(enabled)/double(running);
+        for (int i = 0; i < COUNTER_COUNT; ++i)
+        {
+            if (slots[i] < 0) continue;
+            totals[i] += data[3 + slots[i]]*scale;
+        }
+#endif
+    }
+};
+
+static void print_phase(int grid, char const *solver, char const *phase,
+                        Counters const &c, int steps, double items)
+{
+    printf("%d,%s,%s,%.0f,%.0f,", grid, solver, phase,
+           items, 1e9*c.seconds/steps);
+
+    if (c.has(CYCLES)) printf("%.0f", c.totals[CYCLES]/steps);
+    printf(",");
+    if (c.has(INSTRUCTIONS))
+    {
+        printf("%.0f", c.totals[INSTRUCTIONS]/steps);
+    }
+    printf(",");
+    if (c.has(CYCLES) && c.has(INSTRUCTIONS) && c.totals[CYCLES] > 0)
+    {
+        printf("%.3f", c.totals[INSTRUCTIONS]/c.totals[CYCLES]);
+    }
+    printf(",");
+
+    double total = items*steps;
+    if (c.has(CACHE_MISSES)) printf("%.4f", c.totals[CACHE_MISSES]/total);
+    printf(",");
+    if (c.has(BRANCH_MISSES)) printf("%.4f", c.totals[BRANCH_MISSES]/total);
+    printf(",");
+    if (c.has(CACHE_MISSES))
+    {
+        printf("%.2f", c.totals[CACHE_MISSES]*double(CACHE_LINE)/total);
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<int> grids = {20, 50, 100};
+    std::vector<char const *> solvers = {"relax", "stencil"};
+    int steps = 300;
+    int warmup = 60;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        char *value = strchr(argv[i], '=');
+        if (value == nullptr)
+        {
+            fprintf(stderr, "bad argument: %s\n", argv[i]);
+            return 1;
+        }
+        *value++ = '\0';
+
+        if (strcmp(argv[i], "grid") == 0)
+        {
+            grids.clear();
+            for (char *s : split_list(value))
+            {
+                int grid;
+                if (!parse_int("grid", s, MIN_CLOTH_GRID, &grid)) return 1;
+                grids.push_back(grid);
+            }
+            if (grids.empty())
+            {
+                fprintf(stderr, "grid needs at least one size\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "solver") == 0)
+        {
+            solvers.clear();
+            for (char *s : split_list(value)) solvers.push_back(s);
+        }
+        else if (strcmp(argv[i], "steps") == 0)
+        {
+            if (!parse_int("steps", value, 1, &steps)) return 1;
+        }
+        else if (strcmp(argv[i], "warmup") == 0)
+        {
+            if (!parse_int("warmup", value, 0, &warmup)) return 1;
+        }
+        else
+        {
+            fprintf(stderr, "unknown key: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    Counters integrate, sweep;
+    // open both so each group reports its own status
+    bool integrate_open = integrate.open();
+    bool sweep_open = sweep.open();
+    if (!integrate_open)
+    {
+        fprintf(stderr, "integrate counters unavailable, "
+                        "reporting wall clock only\n");
+    }
+    if (!sweep_open)
+    {
+        fprintf(stderr, "sweep counters unavailable, "
+                        "reporting wall clock only\n");
+    }
+
+    printf("grid,solver,phase,items,ns_per_step,cycles_per_step,"
+           "instructions_per_step,ipc,cache_misses_per_item,"
+           "branch_misses_per_item,bytes_per_item\n");
+
+    constexpr float dt = 1/60.0f;
+    for (int grid : grids)
+    {
+        for (char const *name : solvers)
+        {
+            ClothSolver solver;
+            if (strcmp(name, "relax") == 0) solver = ClothSolver::RELAX;
+            else if (strcmp(name, "stencil") == 0)
+            {
+                solver = ClothSolver::STENCIL;
+            }
+            else
+            {
+                fprintf(stderr, "can't profile solver %s\n", name);
+                continue;
+            }
+
+            Cloth cloth({-.75f, .75f}, {1.5f, 1.5f}, grid, grid, solver);
+            for (int i = 0; i < warmup; ++i)
+            {
+                cloth.update(dt);
+            }
+
+            integrate.reset();
+            sweep.reset();
+            for (int i = 0; i < steps; ++i)
+            {
+                integrate.start();
+                cloth.integrate(dt);
+                integrate.stop();
+
+                for (int j = 0; j < cloth.iterations; ++j)
+                {
+                    sweep.start();
+                    cloth.relax();
+                    sweep.stop();
+                }
+            }
+
+            double links = double(cloth.link_count())*cloth.iterations;
+            print_phase(grid, name, "integrate", integrate,
+                        steps, cloth.points.size());
+            print_phase(grid, name, "sweep", sweep, steps, links);
+        }
+    }
+
+    integrate.close_all();
+    sweep.close_all();
+    return 0;
+}
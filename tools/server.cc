@@ -0,0 +1,100 @@
+// Headless simulation server.
+//
+// usage: server [name] [grid] [hz]
+//
+// steps a grid x grid cloth at hz steps per second and publishes every
+// state to the shared memory segment /name, see shared.hh. viewers attach
+// with `prog --view name` and pinned points they drag come back as
+// commands on /tmp/name.sock. defaults to cloth, 50 and 60.
+
+#include "sim.hh"
+#include "shared.hh"
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+
+static volatile sig_atomic_t g_running = 1;
+
+static void stop(int)
+{
+    g_running = 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char const *name = argc > 1 ? argv[1] : "cloth";
+    int grid = argc > 2 ? atoi(argv[2]) : 50;
+    int hz = argc > 3 ? atoi(argv[3]) : 60;
+    if (grid < 2 || hz <= 0)
+    {
+        fprintf(stderr, "usage: server [name] [grid] [hz]\n");
+        return 1;
+    }
+
+    SharedState shared;
+    if (!shared.create(name, grid, grid))
+    {
+        // NOTE: no destroy, the name may belong to a live server
+        fprintf(stderr, "can't create shared state %s\n", name);
+        return 1;
+    }
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    Cloth sim({-.75f, .75f}, {1.5f, 1.5f}, grid, grid);
+    std::vector<Vec2> positions(sim.points.size());
+
+    int held = -1;
+    Vec2 target = {};
+
+    float dt = 1/float(hz);
+    long period = 1000000000L/hz;
+    timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    for (uint64_t step = 0; g_running; ++step)
+    {
+        Command c;
+        while (shared.receive(&c))
+        {
+            if (c.type == CommandType::RELEASE)
+            {
+                held = -1;
+            }
+            else if (c.type == CommandType::MOVE &&
+                     c.index >= 0 && c.index < (int)sim.points.size() &&
+                     sim.points[c.index].fixed)
+            {
+                held = c.index;
+                target = {c.x, c.y};
+            }
+        }
+
+        // same easing the renderer uses when dragging locally
+        if (held >= 0)
+        {
+            Particle &p = sim.points[held];
+            p.pos += (target - p.pos)*0.25f;
+        }
+
+        sim.update(dt);
+
+        for (size_t i = 0; i < sim.points.size(); ++i)
+        {
+            positions[i] = sim.points[i].pos;
+        }
+        shared.publish(positions.data(), step, dt);
+
+        next.tv_nsec += period;
+        if (next.tv_nsec >= 1000000000L)
+        {
+            next.tv_nsec -= 1000000000L;
+            ++next.tv_sec;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+    }
+
+    shared.destroy(name);
+    return 0;
+}
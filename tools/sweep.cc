@@ -0,0 +1,519 @@
+// Headless parameter sweep runner.
+//
+// usage: sweep [key=v1,v2,...]... [@spec_file]
+//
+// every key takes a comma separated list and the runner simulates the
+// cartesian product of all of them, one run per core at a time, writing a
+// line per finished run to stdout. a spec file holds the same key=value
+// tokens separated by whitespace, lines starting with # are skipped.
+//
+//   kind        cloth, rope
+//   solver      relax, stencil, implicit, fixed (cloth), direct (rope)
+//   grid        cloth width and height (>= 2), or rope particle count (>= 1)
+//   iterations  relaxation sweeps per step (>= 0)
+//   top_mass    mass of the cloth's top row (> 0)
+//   dt          timestep in seconds (> 0)
+//   seconds     simulated time per run (> 0)
+//   threads     worker count, defaults to every core
+//   format      csv, json (one object per line)
+//   max_stretch fail (exit 1) if any run's peak stretch goes above this
+
+#include "sim.hh"
+#include "fixed_cloth.hh"
+#include "args.hh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// NOTE: a run counts as settled once no particle moves faster than this
+static constexpr float SETTLE_SPEED = 0.01f;
+
+enum class Kind
+{
+    CLOTH,
+    ROPE,
+};
+
+struct Run
+{
+    Kind kind;
+    ClothSolver cloth_solver;
+    RopeSolver rope_solver;
+    char const *solver_name;
+    int grid;
+    int iterations;
+    float top_mass;
+    float dt;
+    int steps;
+};
+
+struct Result
+{
+    float stretch;      // worst relative link stretch at the end
+    float peak_stretch; // worst relative link stretch during the run
+    float settle_time; // seconds, -1 if it never settled
+    double steps_per_sec;
+};
+
+struct Spec
+{
+    std::vector<char const *> kinds = {"cloth"};
+    std::vector<char const *> solvers = {"relax"};
+    std::vector<float> grids = {50};
+    std::vector<float> iterations = {30};
+    std::vector<float> top_masses = {100};
+    std::vector<float> dts = {1/60.0f};
+    std::vector<float> seconds = {10};
+    int threads = 0;
+    bool json = false;
+    float max_stretch = -1;
+};
+
+// NOTE: every value has to be at least lowest, or above it if exclusive
+static bool parse_numbers(char const *key, char *list, std::vector<float> &out,
+                          float lowest, bool exclusive = false)
+{
+    out.clear();
+    for (char *s : split_list(list))
+    {
+        char *end;
+        float value = strtof(s, &end);
+        if (*end != '\0') return false;
+
+        if (!(exclusive ? value > lowest : value >= lowest))
+        {
+            fprintf(stderr, "%s must be %s %g, got %s\n", key, 
+                    exclusive ? "above" : "at least", lowest, s);
+            return false;
+        }
+        out.push_back(value);
+    }
+    return !out.empty();
+}
+
+static bool parse_integers(char const *key, char *list, 
+                           std::vector<float> &out, float lowest)
+{
+    if (!parse_numbers(key, list, out, lowest)) return false;
+    for (float v : out)
+    {
+        if (v != floorf(v))
+        {
+            fprintf(stderr, "%s must be a whole number, got %g\n", key, v);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool parse_names(char *list, std::vector<char const *> &out)
+{
+    out.clear();
+    for (char *s : split_list(list))
+    {
+        out.push_back(s);
+    }
+    return !out.empty();
+}
+
+static bool parse_token(Spec &spec, char *token)
+{
+    char *value = strchr(token, '=');
+    if (value == nullptr) return false;
+    *value++ = '\0';
+
+    if (strcmp(token, "kind") == 0) return parse_names(value, spec.kinds);
+    if (strcmp(token, "solver") == 0) return parse_names(value, spec.solvers);
+    // NOTE: grid is checked per kind in expand
+    if (strcmp(token, "grid") == 0) return parse_integers(token, value, spec.grids, MIN_ROPE_GRID);
+    if (strcmp(token, "iterations") == 0) return parse_integers(token, value, spec.iterations, 0);
+    if (strcmp(token, "top_mass") == 0) return parse_numbers(token, value, spec.top_masses, 0, true);
+    if (strcmp(token, "dt") == 0) return parse_numbers(token, value, spec.dts, 0, true);
+    if (strcmp(token, "seconds") == 0) return parse_numbers(token, value, spec.seconds, 0, true);
+
+    if (strcmp(token, "threads") == 0)
+    {
+        spec.threads = atoi(value);
+        return true;
+    }
+
+    if (strcmp(token, "max_stretch") == 0)
+    {
+        char *end;
+        spec.max_stretch = strtof(value, &end);
+        return *end == '\0' && spec.max_stretch >= 0;
+    }
+
+    if (strcmp(token, "format") == 0)
+    {
+        spec.json = strcmp(value, "json") == 0;
+        return spec.json || strcmp(value, "csv") == 0;
+    }
+
+    return false;
+}
+
+// NOTE: tokens point into the returned buffer, so it has to outlive them
+static char *read_file(char const *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) return nullptr;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *data = (char *)malloc(size + 1);
+    size_t read = fread(data, 1, size, file);
+    data[read] = '\0';
+    fclose(file);
+
+    // blank out comments
+    for (char *c = data; *c != '\0'; ++c)
+    {
+        if (*c != '#') continue;
+        while (*c != '\0' && *c != '\n') *c++ = ' ';
+        if (*c == '\0') break;
+    }
+
+    return data;
+}
+
+static bool parse_file(Spec &spec, char const *path)
+{
+    char *data = read_file(path);
+    if (data == nullptr)
+    {
+        fprintf(stderr, "can't open %s\n", path);
+        return false;
+    }
+
+    // split on whitespace first, parse_token uses strtok for the lists
+    std::vector<char *> tokens;
+    for (char *t = strtok(data, " \t\r\n"); t != nullptr;
+         t = strtok(nullptr, " \t\r\n"))
+    {
+        tokens.push_back(t);
+    }
+
+    for (char *t : tokens)
+    {
+        if (!parse_token(spec, t))
+        {
+            fprintf(stderr, "bad spec entry: %s\n", t);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool make_run(char const *kind, char const *solver, Run &run)
+{
+    run.solver_name = solver;
+    if (strcmp(kind, "cloth") == 0)
+    {
+        run.kind = Kind::CLOTH;
+        if (strcmp(solver, "relax") == 0) run.cloth_solver = ClothSolver::RELAX;
+        else if (strcmp(solver, "stencil") == 0) run.cloth_solver = ClothSolver::STENCIL;
+        else if (strcmp(solver, "implicit") == 0) run.cloth_solver = ClothSolver::IMPLICIT;
+        else if (strcmp(solver, "fixed") == 0) run.cloth_solver = ClothSolver::FIXED;
+        else return false;
+        return true;
+    }
+
+    if (strcmp(kind, "rope") == 0)
+    {
+        run.kind = Kind::ROPE;
+        if (strcmp(solver, "relax") == 0) run.rope_solver = RopeSolver::RELAX;
+        else if (strcmp(solver, "direct") == 0) run.rope_solver = RopeSolver::DIRECT;
+        else return false;
+        return true;
+    }
+
+    return false;
+}
+
+static bool expand(Spec const &spec, std::vector<Run> &runs)
+{
+    runs.clear();
+
+    // NOTE: a solver only has to fit one kind, the others skip it
+    Run probe;
+    for (char const *kind : spec.kinds)
+    {
+        if (strcmp(kind, "cloth") != 0 && strcmp(kind, "rope") != 0)
+        {
+            fprintf(stderr, "unknown kind %s\n", kind);
+            return false;
+        }
+    }
+
+    for (char const *solver : spec.solvers)
+    {
+        if (!make_run("cloth", solver, probe) && 
+            !make_run("rope", solver, probe))
+        {
+            fprintf(stderr, "unknown solver %s\n", solver);
+            return false;
+        }
+    }
+
+    for (char const *kind : spec.kinds)
+    for (char const *solver : spec.solvers)
+    for (float grid : spec.grids)
+    for (float iterations : spec.iterations)
+    for (float top_mass : spec.top_masses)
+    for (float dt : spec.dts)
+    for (float seconds : spec.seconds)
+    {
+        Run run;
+        if (!make_run(kind, solver, run)) continue;
+
+        if (!check_grid(kind, (int)grid)) return false;
+
+        if (run.kind == Kind::CLOTH && 
+            run.cloth_solver == ClothSolver::FIXED &&
+            !has_fixed_kernel((int)grid, (int)grid, (int)iterations))
+        {
+            fprintf(stderr, "no fixed kernel for grid=%g iterations=%g, "
+                    "only %dx%d with %d\n", grid, iterations,
+                    DefaultFixedCloth::width, DefaultFixedCloth::height,
+                    DefaultFixedCloth::iterations);
+            return false;
+        }
+
+        double steps = seconds/double(dt) + 0.5;
+        if (steps >= INT_MAX)
+        {
+            fprintf(stderr, "%g seconds at dt=%g is too many steps\n", 
+                    seconds, dt);
+            return false;
+        }
+
+        run.grid = (int)grid;
+        run.iterations = (int)iterations;
+        run.top_mass = top_mass;
+        run.dt = dt;
+        run.steps = (int)steps;
+        runs.push_back(run);
+    }
+    return true;
+}
+
+static float max_speed(std::vector<Particle> const &points, float dt)
+{
+    float speed = 0;
+    for (auto &p : points)
+    {
+        speed = fmaxf(speed, p.pos.dist(p.old_pos)/dt);
+    }
+    return speed;
+}
+
+static float link_stretch(Cloth const &cloth)
+{
+    float stretch = 0;
+    for (int i = 0; i < cloth.height; ++i)
+    {
+        for (int j = 0; j < cloth.width; ++j)
+        {
+            Vec2 p = cloth.points[j + i*cloth.width].pos;
+            if (j + 1 < cloth.width)
+            {
+                Vec2 q = cloth.points[j + 1 + i*cloth.width].pos;
+                stretch = fmaxf(stretch, p.dist(q)/cloth.link_x - 1);
+            }
+
+            if (i + 1 < cloth.height)
+            {
+                Vec2 q = cloth.points[j + (i + 1)*cloth.width].pos;
+                stretch = fmaxf(stretch, p.dist(q)/cloth.link_y - 1);
+            }
+        }
+    }
+    return stretch;
+}
+
+static float link_stretch(Rope const &rope)
+{
+    float stretch = 0;
+    for (size_t i = 0; i + 1 < rope.points.size(); ++i)
+    {
+        float d = rope.points[i].pos.dist(rope.points[i + 1].pos);
+        stretch = fmaxf(stretch, fabsf(d/rope.link_length - 1));
+    }
+    return stretch;
+}
+
+template <typename Sim>
+static Result step(Sim &sim, Run const &run)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    int last_moving = -1;
+    float peak = 0;
+    double measuring = 0;
+    for (int i = 0; i < run.steps; ++i)
+    {
+        sim.update(run.dt);
+        if (max_speed(sim.points, run.dt) > SETTLE_SPEED)
+        {
+            last_moving = i;
+        }
+
+        // keep measuring out of steps_per_sec
+        auto measure = std::chrono::steady_clock::now();
+        peak = fmaxf(peak, link_stretch(sim));
+        std::chrono::duration<double> spent =
+            std::chrono::steady_clock::now() - measure;
+        measuring += spent.count();
+    }
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    Result result;
+    result.stretch = link_stretch(sim);
+    result.peak_stretch = peak;
+    result.settle_time = last_moving + 1 < run.steps ?
+        (last_moving + 1)*run.dt : -1;
+    result.steps_per_sec = run.steps/(elapsed.count() - measuring);
+    return result;
+}
+
+static Result simulate(Run const &run)
+{
+    if (run.kind == Kind::ROPE)
+    {
+        Rope rope({0, 0}, {1.5f, 0}, run.grid, run.rope_solver);
+        rope.iterations = run.iterations;
+
+        return step(rope, run);
+    }
+
+    Cloth cloth({-.75f, .75f}, {1.5f, 1.5f},
+                run.grid, run.grid, run.cloth_solver);
+    cloth.iterations = run.iterations;
+    for (int i = 0; i < cloth.width; ++i)
+    {
+        cloth.points[i].mass = run.top_mass;
+    }
+
+    return step(cloth, run);
+}
+
+static void print_result(int index, Run const &run,
+                         Result const &result, bool json)
+{
+    char const *kind = run.kind == Kind::CLOTH ? "cloth" : "rope";
+    if (json)
+    {
+        printf("{\"run\": %d, \"kind\": \"%s\", \"solver\": \"%s\", "
+               "\"grid\": %d, \"iterations\": %d, \"top_mass\": %g, "
+               "\"dt\": %g, \"steps\": %d, \"stretch\": %g, "
+               "\"peak_stretch\": %g, \"settle_time\": %g, "
+               "\"steps_per_sec\": %.1f}\n",
+               index, kind, run.solver_name, run.grid, run.iterations,
+               run.top_mass, run.dt, run.steps, result.stretch,
+               result.peak_stretch, result.settle_time, 
+               result.steps_per_sec);
+    }
+    else
+    {
+        printf("%d,%s,%s,%d,%d,%g,%g,%d,%g,%g,%g,%.1f\n",
+               index, kind, run.solver_name, run.grid, run.iterations,
+               run.top_mass, run.dt, run.steps, result.stretch,
+               result.peak_stretch, result.settle_time, 
+               result.steps_per_sec);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    Spec spec;
+    for (int i = 1; i < argc; ++i)
+    {
+        bool ok = argv[i][0] == '@' ?
+            parse_file(spec, argv[i] + 1) :
+            parse_token(spec, argv[i]);
+
+        if (!ok)
+        {
+            fprintf(stderr, "bad argument: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    std::vector<Run> runs;
+    if (!expand(spec, runs)) return 1;
+    if (runs.empty())
+    {
+        fprintf(stderr, "sweep has no valid runs\n");
+        return 1;
+    }
+
+    int threads = spec.threads;
+    if (threads <= 0)
+    {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads <= 0)
+    {
+        threads = 1;
+    }
+
+    if (!spec.json)
+    {
+        printf("run,kind,solver,grid,iterations,top_mass,dt,steps,"
+               "stretch,peak_stretch,settle_time,steps_per_sec\n");
+    }
+
+    // NOTE: runs are independent so workers just pull the next index,
+    // lines come out in completion order and carry their run index.
+    std::atomic<int> next(0);
+    std::atomic<int> failed(0);
+    std::mutex output;
+    auto worker = [&]() {
+        for (int i = next++; i < (int)runs.size(); i = next++)
+        {
+            Result result = simulate(runs[i]);
+            if (spec.max_stretch >= 0 && 
+                !(result.peak_stretch <= spec.max_stretch))
+            {
+                ++failed;
+            }
+
+            std::lock_guard<std::mutex> lock(output);
+            print_result(i, runs[i], result, spec.json);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int i = 0; i < threads; ++i)
+    {
+        pool.emplace_back(worker);
+    }
+
+    for (auto &t : pool)
+    {
+        t.join();
+    }
+
+    if (failed > 0)
+    {
+        fprintf(stderr, "%d runs stretched more than %g\n", 
+                failed.load(), spec.max_stretch);
+        return 1;
+    }
+
+    return 0;
+}